@@ -0,0 +1,375 @@
+/*
+ * Asynchronous output writer.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * The tracer hands the output over to the writer thread through a ring
+ * of ASYNC_OUTPUT_SLOTS entries.  The ring has a single producer and
+ * a single consumer, so it needs no locks: the tracer is the only one
+ * to touch ring_head, the writer thread is the only one to touch
+ * ring_tail, and the ownership of entries is passed back and forth
+ * with a pair of semaphores.  The "items" semaphore counts entries
+ * queued for writing, the "slots" semaphore counts entries available
+ * to the tracer.  The writer thread releases an entry only after its
+ * output is written, so a free entry also carries the result of the
+ * write.
+ *
+ * When the ring is full, the output is either waited for, dropped,
+ * or kept in a spill list until there is room in the ring again,
+ * depending on async_output_policy.  The output is handed over
+ * in arbitrary pieces, not necessarily complete lines, so it is dropped
+ * by whole lines only: the rest of a line that has been partly queued
+ * is waited for, and the rest of a line that has been partly dropped
+ * is dropped, too.
+ */
+
+#include "defs.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include "async_output.h"
+
+enum { ASYNC_OUTPUT_SLOTS = 256 };
+
+struct async_output_entry {
+	char *buf;
+	size_t len;
+	int fd;			/* -1 asks the writer thread to exit */
+	int err;		/* errno of the failed write, if any */
+};
+
+struct async_output_spill {
+	struct async_output_spill *next;
+	struct async_output_entry entry;
+};
+
+enum async_output_policy async_output_policy;
+
+static struct async_output_entry ring[ASYNC_OUTPUT_SLOTS];
+static unsigned int ring_head;
+static unsigned int ring_tail;
+static sem_t ring_items;
+static sem_t ring_slots;
+static pthread_t writer_thread;
+static bool writer_started;
+
+static struct async_output_spill *spill_head;
+static struct async_output_spill **spill_tail = &spill_head;
+
+/* Where the output queued for a file descriptor has stopped.  */
+enum line_state {
+	LINE_START,	/* at the start of a line */
+	LINE_QUEUED,	/* inside a line that has been partly queued */
+	LINE_DROPPED,	/* inside a line that has been partly dropped */
+};
+
+static uint8_t *line_states;
+static size_t line_states_size;
+
+static struct {
+	unsigned long long queued;
+	unsigned long long blocked;
+	unsigned long long spilled;
+	unsigned long long dropped;
+	unsigned long long dropped_bytes;
+	unsigned int max_depth;
+} stats;
+
+static void
+sem_wait_nointr(sem_t *const sem)
+{
+	while (sem_wait(sem) < 0) {
+		if (errno != EINTR)
+			perror_func_msg_and_die("sem_wait");
+	}
+}
+
+static void *
+writer_thread_fn(void *arg)
+{
+	for (;;) {
+		sem_wait_nointr(&ring_items);
+
+		struct async_output_entry *const e = &ring[ring_tail];
+		ring_tail = (ring_tail + 1) % ASYNC_OUTPUT_SLOTS;
+
+		if (e->fd < 0)
+			break;
+
+		const char *buf = e->buf;
+		size_t len = e->len;
+
+		while (len) {
+			ssize_t n = write(e->fd, buf, len);
+
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				e->err = errno;
+				break;
+			}
+			buf += n;
+			len -= n;
+		}
+
+		free(e->buf);
+		e->buf = NULL;
+		sem_post(&ring_slots);
+	}
+
+	return NULL;
+}
+
+static void
+start_writer_thread(void)
+{
+	sigset_t all, orig;
+	int rc;
+
+	if (sem_init(&ring_items, 0, 0) ||
+	    sem_init(&ring_slots, 0, ASYNC_OUTPUT_SLOTS))
+		perror_func_msg_and_die("sem_init");
+
+	/*
+	 * The tracer relies on signals interrupting its syscalls,
+	 * make sure none of them is delivered to the writer thread.
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &orig);
+	rc = pthread_create(&writer_thread, NULL, writer_thread_fn, NULL);
+	pthread_sigmask(SIG_SETMASK, &orig, NULL);
+	if (rc) {
+		errno = rc;
+		perror_func_msg_and_die("pthread_create");
+	}
+
+	writer_started = true;
+}
+
+/*
+ * Errors are reported after the queue is updated: printing the message
+ * writes the pending output, which may get here again.
+ */
+static void
+report_write_error(const int err)
+{
+	if (err) {
+		errno = err;
+		perror_msg("asynchronous write of the output");
+	}
+}
+
+/* Put an entry into an acquired ring slot.  */
+static void
+push_entry(const struct async_output_entry *const entry, int *const err)
+{
+	struct async_output_entry *const e = &ring[ring_head];
+	int items;
+
+	if (e->err && !*err)
+		*err = e->err;
+	e->err = 0;
+
+	e->buf = entry->buf;
+	e->len = entry->len;
+	e->fd = entry->fd;
+	ring_head = (ring_head + 1) % ASYNC_OUTPUT_SLOTS;
+
+	sem_post(&ring_items);
+
+	if (!sem_getvalue(&ring_items, &items)
+	    && (unsigned int) items > stats.max_depth)
+		stats.max_depth = items;
+}
+
+/*
+ * Move spilled entries to the ring while there is room in it.
+ * Returns true if the spill list is empty.
+ */
+static bool
+push_spilled(const bool wait, int *const err)
+{
+	while (spill_head) {
+		if (wait)
+			sem_wait_nointr(&ring_slots);
+		else if (sem_trywait(&ring_slots))
+			return false;
+
+		struct async_output_spill *const s = spill_head;
+
+		push_entry(&s->entry, err);
+		spill_head = s->next;
+		if (!spill_head)
+			spill_tail = &spill_head;
+		free(s);
+	}
+
+	return true;
+}
+
+static uint8_t *
+get_line_state(const int fd)
+{
+	if ((unsigned int) fd >= line_states_size) {
+		const size_t old_size = line_states_size;
+
+		while ((unsigned int) fd >= line_states_size)
+			line_states = xgrowarray(line_states,
+						 &line_states_size,
+						 sizeof(*line_states));
+		memset(line_states + old_size, LINE_START,
+		       line_states_size - old_size);
+	}
+
+	return &line_states[fd];
+}
+
+void
+async_output_write(const int fd, const char *buf, size_t len)
+{
+	uint8_t *const state = get_line_state(fd);
+	int err = 0;
+
+	if (!writer_started)
+		start_writer_thread();
+
+	++stats.queued;
+
+	if (*state == LINE_DROPPED) {
+		const char *const eol = memchr(buf, '\n', len);
+		const size_t n = eol ? (size_t) (eol - buf) + 1 : len;
+
+		stats.dropped_bytes += n;
+		if (!eol)
+			return;
+		*state = LINE_START;
+		buf += n;
+		len -= n;
+		if (!len)
+			return;
+	}
+
+	/* Spilled output has to go first.  */
+	if (!push_spilled(false, &err) || sem_trywait(&ring_slots)) {
+		switch (async_output_policy) {
+		case ASYNC_OUTPUT_SPILL: {
+			struct async_output_spill *const s =
+				xmalloc(sizeof(*s));
+
+			s->next = NULL;
+			s->entry = (struct async_output_entry) {
+				.buf = xmalloc(len),
+				.len = len,
+				.fd = fd,
+			};
+			memcpy(s->entry.buf, buf, len);
+			*spill_tail = s;
+			spill_tail = &s->next;
+			++stats.spilled;
+			*state = buf[len - 1] == '\n'
+				 ? LINE_START : LINE_QUEUED;
+			report_write_error(err);
+			return;
+		}
+
+		case ASYNC_OUTPUT_DROP:
+			if (*state != LINE_QUEUED) {
+				++stats.dropped;
+				stats.dropped_bytes += len;
+				*state = buf[len - 1] == '\n'
+					 ? LINE_START : LINE_DROPPED;
+				report_write_error(err);
+				return;
+			}
+			/* The start of the line is queued already.  */
+			ATTRIBUTE_FALLTHROUGH;
+
+		default:
+			++stats.blocked;
+			sem_wait_nointr(&ring_slots);
+			break;
+		}
+	}
+
+	const struct async_output_entry entry = {
+		.buf = xmalloc(len),
+		.len = len,
+		.fd = fd,
+	};
+
+	memcpy(entry.buf, buf, len);
+	*state = buf[len - 1] == '\n' ? LINE_START : LINE_QUEUED;
+	push_entry(&entry, &err);
+	report_write_error(err);
+}
+
+void
+async_output_wait(void)
+{
+	int err = 0;
+	unsigned int i;
+
+	if (!writer_started)
+		return;
+
+	push_spilled(true, &err);
+
+	/*
+	 * Acquiring all the slots means that the writer thread
+	 * has written all the queued output.
+	 */
+	for (i = 0; i < ASYNC_OUTPUT_SLOTS; ++i)
+		sem_wait_nointr(&ring_slots);
+	for (i = 0; i < ASYNC_OUTPUT_SLOTS; ++i)
+		sem_post(&ring_slots);
+
+	for (i = 0; i < ASYNC_OUTPUT_SLOTS; ++i) {
+		if (ring[i].err && !err)
+			err = ring[i].err;
+		ring[i].err = 0;
+	}
+	report_write_error(err);
+}
+
+void
+async_output_finish(void)
+{
+	static const struct async_output_entry stop = { .fd = -1 };
+	int err = 0;
+
+	/*
+	 * The writer thread may get here only by dying,
+	 * it cannot wait for itself.
+	 */
+	if (!writer_started || pthread_equal(pthread_self(), writer_thread))
+		return;
+
+	async_output_wait();
+
+	sem_wait_nointr(&ring_slots);
+	push_entry(&stop, &err);
+	pthread_join(writer_thread, NULL);
+	writer_started = false;
+	sem_destroy(&ring_items);
+	sem_destroy(&ring_slots);
+	report_write_error(err);
+}
+
+void
+async_output_print_stats(FILE *const outf)
+{
+	if (async_output_policy == ASYNC_OUTPUT_NONE)
+		return;
+
+	fprintf(outf, "Asynchronous output: %llu writes queued, "
+		"%llu blocked, %llu spilled, %llu dropped (%llu bytes), "
+		"max queue depth %u of %u\n",
+		stats.queued, stats.blocked, stats.spilled,
+		stats.dropped, stats.dropped_bytes,
+		stats.max_depth, (unsigned int) ASYNC_OUTPUT_SLOTS);
+}
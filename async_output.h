@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_ASYNC_OUTPUT_H
+# define STRACE_ASYNC_OUTPUT_H
+
+/* What to do with the output when the writer thread falls behind. */
+enum async_output_policy {
+	ASYNC_OUTPUT_NONE,	/* Write the output synchronously. */
+	ASYNC_OUTPUT_BLOCK,	/* Wait for the writer thread. */
+	ASYNC_OUTPUT_DROP,	/* Discard the output by whole lines. */
+	ASYNC_OUTPUT_SPILL,	/* Keep the output in memory. */
+};
+
+extern enum async_output_policy async_output_policy;
+
+/* Queue len bytes of buf to be written to fd by the writer thread. */
+extern void async_output_write(int fd, const char *buf, size_t len);
+/* Wait until all the queued output is written. */
+extern void async_output_wait(void);
+/* Write all the queued output and stop the writer thread. */
+extern void async_output_finish(void);
+extern void async_output_print_stats(FILE *);
+
+#endif /* !STRACE_ASYNC_OUTPUT_H */
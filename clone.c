@@ -13,6 +13,7 @@
 #include "defs.h"
 #include <sched.h>
 #include "scno.h"
+#include "syscall.h"
 
 #ifndef CSIGNAL
 # define CSIGNAL 0x000000ff
@@ -277,6 +278,17 @@ out:
 	return RVAL_DECODED;
 }
 
+bool
+fetch_clone_flags(struct tcb *const tcp, uint64_t *const flags)
+{
+	if (tcp_sysent(tcp)->sen == SEN_clone3) {
+		return tcp->u_arg[1] >= sizeof(*flags) &&
+		       !umove(tcp, tcp->u_arg[0], flags);
+	}
+
+	*flags = tcp->u_arg[ARG_FLAGS];
+	return true;
+}
 
 SYS_FUNC(setns)
 {
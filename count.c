@@ -18,6 +18,27 @@
 
 #include <stdarg.h>
 
+#include "ilog2.h"
+#include "index_table.h"
+
+/*
+ * Call durations are also kept in a log-linear histogram, like in
+ * HdrHistogram: durations shorter than 2^HIST_SUB_BITS nanoseconds
+ * have a bucket each, and every next power of two is split into
+ * 2^(HIST_SUB_BITS - 1) buckets of equal width, so a bucket is no wider
+ * than 1/16 of the durations it holds.  Durations of 2^HIST_MAX_BITS
+ * nanoseconds (about 18 minutes) and longer go to the last bucket.
+ */
+#define HIST_SUB_BITS	5
+#define HIST_MAX_BITS	40
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 2) \
+			 << (HIST_SUB_BITS - 1))
+
+#define HIST_BAR_WIDTH	40
+
+/* Percentiles of the CSC_TIME_P* columns in their order, in per mille. */
+static const unsigned int percentiles[] = { 500, 900, 990, 999 };
+
 /* Per-syscall stats structure */
 struct call_counts {
 	/* time may be total latency or system time */
@@ -25,12 +46,73 @@ struct call_counts {
 	struct timespec time_min;
 	struct timespec time_max;
 	struct timespec time_avg;
+	struct timespec time_pct[ARRAY_SIZE(percentiles)];
 	uint64_t calls, errors;
+	/* HIST_BUCKETS counters, allocated on the first call if needed */
+	uint64_t *hist;
 };
 
 static struct call_counts *countv[SUPPORTED_PERSONALITIES];
 #define counts (countv[current_personality])
 
+/*
+ * With --summary-interval, countv holds the counts of the current interval,
+ * and totalv accumulates the counts of the intervals printed so far.
+ */
+static struct call_counts *totalv[SUPPORTED_PERSONALITIES];
+static bool intervals_started;
+static struct timespec start_ts, interval_start_ts;
+
+/*
+ * With --summary-by, the calls are also counted per group of tracees.
+ * As there may be many groups, e.g. threads, and a group usually makes
+ * few of the syscalls, the counts are kept sparse: the groups and the
+ * counts of syscalls of groups are kept in arrays with index tables.
+ */
+enum count_summary_by {
+	CSB_NONE,
+	CSB_PID,
+	CSB_TGID,
+	CSB_COMM,
+};
+
+static const char *const summary_by_names[] = {
+	[CSB_PID]  = "pid",
+	[CSB_TGID] = "tgid",
+	[CSB_COMM] = "comm",
+};
+
+static enum count_summary_by summary_by;
+static unsigned int summary_top = 10;
+
+#define COMM_LEN	16
+
+struct count_group {
+	int id;			/* pid or tgid, 0 for CSB_COMM */
+	char comm[COMM_LEN];
+	struct timespec time;
+};
+
+struct group_counts {
+	unsigned int group;
+	unsigned int pers;
+	unsigned int scno;
+	struct timespec time;
+	struct timespec time_min;
+	struct timespec time_max;
+	uint64_t calls, errors;
+};
+
+static struct count_group *groups;
+static size_t groups_size;
+static size_t groups_used;
+static struct index_table group_index;
+
+static struct group_counts *group_counts;
+static size_t group_counts_size;
+static size_t group_counts_used;
+static struct index_table group_counts_index;
+
 static const struct timespec zero_ts;
 static const struct timespec max_ts = {
 	(time_t) (long long) (zero_extend_signed_to_ull((time_t) -1ULL) >> 1),
@@ -38,6 +120,9 @@ static const struct timespec max_ts = {
 
 static struct timespec overhead;
 
+/* Whether percentiles are shown or sorted by */
+static bool count_percentiles;
+
 
 enum count_summary_columns {
 	CSC_NONE,
@@ -46,6 +131,10 @@ enum count_summary_columns {
 	CSC_TIME_MIN,
 	CSC_TIME_MAX,
 	CSC_TIME_AVG,
+	CSC_TIME_P50,
+	CSC_TIME_P90,
+	CSC_TIME_P99,
+	CSC_TIME_P999,
 	CSC_CALLS,
 	CSC_ERRORS,
 	CSC_SC_NAME,
@@ -53,6 +142,9 @@ enum count_summary_columns {
 	CSC_MAX,
 };
 
+#define PCT_IDX(c_) ((c_) - CSC_TIME_P50)
+#define IS_PCT_COLUMN(c_) ((c_) >= CSC_TIME_P50 && (c_) <= CSC_TIME_P999)
+
 static uint8_t columns[CSC_MAX] = {
 	CSC_TIME_100S,
 	CSC_TIME_TOTAL,
@@ -87,6 +179,12 @@ static const struct {
 	{ "avg-time",     CSC_TIME_AVG   },
 	{ "time_avg",     CSC_TIME_AVG   },
 	{ "time-avg",     CSC_TIME_AVG   },
+	{ "p50",          CSC_TIME_P50   },
+	{ "median",       CSC_TIME_P50   },
+	{ "p90",          CSC_TIME_P90   },
+	{ "p99",          CSC_TIME_P99   },
+	{ "p999",         CSC_TIME_P999  },
+	{ "p99.9",        CSC_TIME_P999  },
 	{ "calls",        CSC_CALLS      },
 	{ "count",        CSC_CALLS      },
 	{ "error",        CSC_ERRORS     },
@@ -99,6 +197,160 @@ static const struct {
 	{ "nothing",      CSC_NONE       },
 };
 
+static unsigned int
+hist_bucket(const struct timespec *ts)
+{
+	const uint64_t max_ns = (1ULL << HIST_MAX_BITS) - 1;
+	const uint64_t ns = (uint64_t) ts->tv_sec <= max_ns / 1000000000
+			    ? MIN(ts->tv_sec * 1000000000ULL + ts->tv_nsec,
+				  max_ns)
+			    : max_ns;
+
+	if (ns < (1U << HIST_SUB_BITS))
+		return ns;
+
+	const unsigned int shift = ilog2_64(ns) - HIST_SUB_BITS + 1;
+
+	return (shift << (HIST_SUB_BITS - 1)) + (ns >> shift);
+}
+
+/* Returns the shortest duration in the bucket, in nanoseconds. */
+static uint64_t
+hist_bucket_start(const unsigned int bucket)
+{
+	if (bucket < (1U << HIST_SUB_BITS))
+		return bucket;
+
+	const unsigned int shift = (bucket >> (HIST_SUB_BITS - 1)) - 1;
+
+	return (uint64_t) (bucket - (shift << (HIST_SUB_BITS - 1))) << shift;
+}
+
+static bool
+group_matches(const unsigned int num, const void *key)
+{
+	const struct count_group *g = &groups[num];
+	const struct count_group *k = key;
+
+	return g->id == k->id
+	       && (summary_by != CSB_COMM || !strcmp(g->comm, k->comm));
+}
+
+/*
+ * Returns the number of the group of the tracee.  The group is looked up
+ * once and then after every execve, so renames of threads are not seen.
+ */
+static unsigned int
+get_tcb_group(struct tcb *tcp)
+{
+	if (tcp->count_group)
+		return tcp->count_group - 1;
+
+	struct count_group key = { .id = 0 };
+	uint32_t hash;
+
+	switch (summary_by) {
+	case CSB_PID:
+		key.id = tcp->pid;
+		break;
+	case CSB_TGID:
+		key.id = get_proc_tgid(tcp->pid);
+		break;
+	default:
+		break;
+	}
+
+	get_proc_comm(key.id ? key.id : tcp->pid, key.comm, sizeof(key.comm));
+
+	if (summary_by == CSB_COMM)
+		hash = hash_string(HASH_INIT, key.comm);
+	else
+		hash = hash_bytes(HASH_INIT, &key.id, sizeof(key.id));
+
+	unsigned int num = index_table_lookup(&group_index, hash,
+					      group_matches, &key);
+
+	if (num == INDEX_TABLE_NONE) {
+		if (groups_used >= groups_size)
+			groups = xgrowarray(groups, &groups_size,
+					    sizeof(*groups));
+		groups[groups_used] = key;
+		num = groups_used++;
+		index_table_add(&group_index, hash, num);
+	}
+
+	tcp->count_group = num + 1;
+	return num;
+}
+
+static bool
+group_counts_matches(const unsigned int num, const void *key)
+{
+	const struct group_counts *gc = &group_counts[num];
+	const struct group_counts *k = key;
+
+	return gc->group == k->group && gc->pers == k->pers
+	       && gc->scno == k->scno;
+}
+
+static void
+count_group_syscall(struct tcb *tcp, const struct timespec *ts)
+{
+	const struct group_counts key = {
+		.group = get_tcb_group(tcp),
+		.pers = current_personality,
+		.scno = tcp->scno,
+		.time_min = max_ts,
+	};
+	uint32_t hash = hash_bytes(HASH_INIT, &key.group, sizeof(key.group));
+
+	hash = hash_bytes(hash, &key.pers, sizeof(key.pers));
+	hash = hash_bytes(hash, &key.scno, sizeof(key.scno));
+
+	unsigned int num = index_table_lookup(&group_counts_index, hash,
+					      group_counts_matches, &key);
+
+	if (num == INDEX_TABLE_NONE) {
+		if (group_counts_used >= group_counts_size)
+			group_counts = xgrowarray(group_counts,
+						  &group_counts_size,
+						  sizeof(*group_counts));
+		group_counts[group_counts_used] = key;
+		num = group_counts_used++;
+		index_table_add(&group_counts_index, hash, num);
+	}
+
+	struct group_counts *const gc = &group_counts[num];
+
+	gc->calls++;
+	if (syserror(tcp))
+		gc->errors++;
+
+	ts_add(&gc->time, &gc->time, ts);
+	gc->time_min = *ts_min(&gc->time_min, ts);
+	gc->time_max = *ts_max(&gc->time_max, ts);
+	ts_add(&groups[gc->group].time, &groups[gc->group].time, ts);
+}
+
+int
+set_count_summary_by(const char *s)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(summary_by_names); ++i) {
+		if (summary_by_names[i] && !strcmp(summary_by_names[i], s)) {
+			summary_by = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+void
+set_count_summary_top(const unsigned int n)
+{
+	summary_top = n;
+}
+
 void
 count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
 {
@@ -133,6 +385,18 @@ count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
 	ts_add(&cc->time, &cc->time, wts_nonneg);
 	cc->time_min = *ts_min(&cc->time_min, wts_nonneg);
 	cc->time_max = *ts_max(&cc->time_max, wts_nonneg);
+
+	if (count_percentiles || count_histogram) {
+		if (!cc->hist)
+			cc->hist = xcalloc(HIST_BUCKETS, sizeof(*cc->hist));
+		cc->hist[hist_bucket(wts_nonneg)]++;
+	}
+
+	if (summary_by)
+		count_group_syscall(tcp, wts_nonneg);
+
+	if (io_summary_enabled)
+		count_io_syscall(tcp, wts_nonneg);
 }
 
 static int
@@ -164,6 +428,37 @@ avg_time_cmp(const void *a, const void *b)
 		       &counts[*((unsigned int *) b)].time_avg);
 }
 
+static int
+pct_time_cmp(const void *a, const void *b, const unsigned int pct)
+{
+	return -ts_cmp(&counts[*((unsigned int *) a)].time_pct[pct],
+		       &counts[*((unsigned int *) b)].time_pct[pct]);
+}
+
+static int
+p50_time_cmp(const void *a, const void *b)
+{
+	return pct_time_cmp(a, b, PCT_IDX(CSC_TIME_P50));
+}
+
+static int
+p90_time_cmp(const void *a, const void *b)
+{
+	return pct_time_cmp(a, b, PCT_IDX(CSC_TIME_P90));
+}
+
+static int
+p99_time_cmp(const void *a, const void *b)
+{
+	return pct_time_cmp(a, b, PCT_IDX(CSC_TIME_P99));
+}
+
+static int
+p999_time_cmp(const void *a, const void *b)
+{
+	return pct_time_cmp(a, b, PCT_IDX(CSC_TIME_P999));
+}
+
 static int
 syscall_cmp(const void *a, const void *b)
 {
@@ -208,6 +503,10 @@ set_sortby(const char *sortby)
 		[CSC_TIME_MIN]   = min_time_cmp,
 		[CSC_TIME_MAX]   = max_time_cmp,
 		[CSC_TIME_AVG]   = avg_time_cmp,
+		[CSC_TIME_P50]   = p50_time_cmp,
+		[CSC_TIME_P90]   = p90_time_cmp,
+		[CSC_TIME_P99]   = p99_time_cmp,
+		[CSC_TIME_P999]  = p999_time_cmp,
 		[CSC_CALLS]      = count_cmp,
 		[CSC_ERRORS]     = error_cmp,
 		[CSC_SC_NAME]    = syscall_cmp,
@@ -216,6 +515,8 @@ set_sortby(const char *sortby)
 	for (size_t i = 0; i < ARRAY_SIZE(column_aliases); ++i) {
 		if (!strcmp(column_aliases[i].name, sortby)) {
 			sortfun = sort_fns[column_aliases[i].column];
+			if (IS_PCT_COLUMN(column_aliases[i].column))
+				count_percentiles = true;
 			return;
 		}
 	}
@@ -257,6 +558,9 @@ set_count_summary_columns(const char *s)
 			visible[column_aliases[i].column] = 1;
 			found = true;
 
+			if (IS_PCT_COLUMN(column_aliases[i].column))
+				count_percentiles = true;
+
 			break;
 		}
 
@@ -295,6 +599,107 @@ num_chars(const char *fmt, ...)
 	return (unsigned int) MAX(ret, 0);
 }
 
+/*
+ * Calculate the percentiles of the durations in the histogram.
+ * A percentile is reported as the middle of its bucket, clamped
+ * to the shortest and the longest observed durations.
+ */
+static void
+hist_percentiles(const uint64_t *hist, const uint64_t calls,
+		 const struct timespec *min, const struct timespec *max,
+		 struct timespec *pct)
+{
+	unsigned int bucket = 0;
+	uint64_t seen = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(percentiles); ++i) {
+		const uint64_t rank = calls / 1000 * percentiles[i]
+			+ ((calls % 1000) * percentiles[i] + 999) / 1000;
+
+		while (bucket < HIST_BUCKETS - 1 && seen + hist[bucket] < rank)
+			seen += hist[bucket++];
+
+		const uint64_t start = hist_bucket_start(bucket);
+		const uint64_t mid =
+			start + (hist_bucket_start(bucket + 1) - start) / 2;
+
+		pct[i].tv_sec = mid / 1000000000;
+		pct[i].tv_nsec = mid % 1000000000;
+		pct[i] = *ts_min(ts_max(&pct[i], min), max);
+	}
+}
+
+static const char *
+sprint_ns(char *buf, const size_t size, const uint64_t ns)
+{
+	static const struct {
+		const char *unit;
+		double ns;
+	} units[] = {
+		{ "s",  1e9 },
+		{ "ms", 1e6 },
+		{ "us", 1e3 },
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(units); ++i) {
+		if (ns >= units[i].ns) {
+			snprintf(buf, size, "%.4g%s", ns / units[i].ns,
+				 units[i].unit);
+			return buf;
+		}
+	}
+
+	snprintf(buf, size, "%" PRIu64 "%s", ns, ns ? "ns" : "");
+	return buf;
+}
+
+/*
+ * Print the histogram of durations of a syscall, with a row
+ * per power of two nanoseconds.
+ */
+static void
+print_histogram(FILE *outf, const char *name, const uint64_t *hist,
+		const uint64_t calls)
+{
+	static const char bar[HIST_BAR_WIDTH + 1] =
+		"@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@";
+	uint64_t rows[HIST_MAX_BITS] = { 0 };
+	uint64_t rows_max = 0;
+	unsigned int first = HIST_MAX_BITS - 1;
+	unsigned int last = 0;
+
+	for (unsigned int i = 0; i < HIST_BUCKETS; ++i) {
+		if (!hist[i])
+			continue;
+
+		const unsigned int row = ilog2_64(hist_bucket_start(i));
+
+		rows[row] += hist[i];
+		rows_max = MAX(rows_max, rows[row]);
+		first = MIN(first, row);
+		last = MAX(last, row);
+	}
+
+	fprintf(outf, "\n%s (%" PRIu64 " calls):\n", name, calls);
+
+	const int count_width = num_chars("%" PRIu64, rows_max);
+
+	for (unsigned int row = first; row <= last; ++row) {
+		char lo[32], hi[32], range[sizeof(lo) + sizeof(hi) + 4];
+		const unsigned int len = rows_max
+			? (rows[row] * HIST_BAR_WIDTH + rows_max - 1) / rows_max
+			: 0;
+
+		snprintf(range, sizeof(range), "[%s, %s)",
+			 sprint_ns(lo, sizeof(lo), row ? 1ULL << row : 0),
+			 row < HIST_MAX_BITS - 1
+			 ? sprint_ns(hi, sizeof(hi), 2ULL << row) : "inf");
+		fprintf(outf, "%-20s %*" PRIu64 " |%-*.*s|\n",
+			range, count_width, rows[row],
+			HIST_BAR_WIDTH, (int) len, bar);
+	}
+}
+
 static void
 call_summary_pers(FILE *outf)
 {
@@ -306,6 +711,9 @@ call_summary_pers(FILE *outf)
 	const struct timespec *tv_min_max = &zero_ts;
 	const struct timespec *tv_max = &zero_ts;
 	const struct timespec *tv_avg_max = &zero_ts;
+	struct timespec tv_pct[ARRAY_SIZE(percentiles)] = { { 0 } };
+	uint64_t *hist_cum = count_percentiles
+			     ? xcalloc(HIST_BUCKETS, sizeof(*hist_cum)) : NULL;
 	uint64_t call_cum = 0;
 	uint64_t error_cum = 0;
 
@@ -332,10 +740,24 @@ call_summary_pers(FILE *outf)
 		ts_div(&counts[i].time_avg, &counts[i].time, counts[i].calls);
 		tv_avg_max = ts_max(tv_avg_max, &counts[i].time_avg);
 
+		if (hist_cum && counts[i].hist) {
+			hist_percentiles(counts[i].hist, counts[i].calls,
+					 &counts[i].time_min,
+					 &counts[i].time_max,
+					 counts[i].time_pct);
+			for (size_t j = 0; j < HIST_BUCKETS; ++j)
+				hist_cum[j] += counts[i].hist[j];
+		}
+
 		sc_name_max = MAX(sc_name_max, strlen(sysent[i].sys_name));
 	}
 	float_tv_cum = ts_float(&tv_cum);
 
+	if (hist_cum) {
+		hist_percentiles(hist_cum, call_cum, tv_min, tv_max, tv_pct);
+		free(hist_cum);
+	}
+
 	if (sortfun)
 		qsort((void *) indices, nsyscalls, sizeof(indices[0]), sortfun);
 
@@ -352,6 +774,10 @@ call_summary_pers(FILE *outf)
 		[CSC_TIME_100S]  = { ARRSZ_PAIR("% time") - 1,   "%1$*2$.2f" },
 		[CSC_TIME_MIN]   = { ARRSZ_PAIR("shortest") - 1, "%1$*2$.6f" },
 		[CSC_TIME_MAX]   = { ARRSZ_PAIR("longest") - 1,  "%1$*2$.6f" },
+		[CSC_TIME_P50]   = { ARRSZ_PAIR("p50") - 1,      "%1$*2$.6f" },
+		[CSC_TIME_P90]   = { ARRSZ_PAIR("p90") - 1,      "%1$*2$.6f" },
+		[CSC_TIME_P99]   = { ARRSZ_PAIR("p99") - 1,      "%1$*2$.6f" },
+		[CSC_TIME_P999]  = { ARRSZ_PAIR("p99.9") - 1,    "%1$*2$.6f" },
 		/* Historical field sizes are preserved */
 		[CSC_TIME_TOTAL] = { "seconds",    11, "%1$*2$.6f" },
 		[CSC_TIME_AVG]   = { "usecs/call", 11, "%1$*2$" PRIu64 },
@@ -372,6 +798,14 @@ call_summary_pers(FILE *outf)
 		W_(CSC_TIME_AVG,   num_chars("%" PRId64 ,
 					     (uint64_t) (ts_float(tv_avg_max)
 							 * 1e6))),
+		W_(CSC_TIME_P50,   num_chars("%" PRId64 ".000000",
+					     (int64_t) tv_max->tv_sec)),
+		W_(CSC_TIME_P90,   num_chars("%" PRId64 ".000000",
+					     (int64_t) tv_max->tv_sec)),
+		W_(CSC_TIME_P99,   num_chars("%" PRId64 ".000000",
+					     (int64_t) tv_max->tv_sec)),
+		W_(CSC_TIME_P999,  num_chars("%" PRId64 ".000000",
+					     (int64_t) tv_max->tv_sec)),
 		W_(CSC_CALLS,      num_chars("%" PRIu64, call_cum)),
 		W_(CSC_ERRORS,     num_chars("%" PRIu64, error_cum)),
 		W_(CSC_SC_NAME,    sc_name_max + 1),
@@ -424,6 +858,10 @@ call_summary_pers(FILE *outf)
 		FC_(CSC_TIME_MIN);
 		FC_(CSC_TIME_MAX);
 		FC_(CSC_TIME_AVG);
+		FC_(CSC_TIME_P50);
+		FC_(CSC_TIME_P90);
+		FC_(CSC_TIME_P99);
+		FC_(CSC_TIME_P999);
 		FC_(CSC_CALLS);
 		FC_(CSC_ERRORS);
 		FC_(CSC_SC_NAME);
@@ -457,6 +895,14 @@ call_summary_pers(FILE *outf)
 			PC_(CSC_TIME_MAX,   ts_float(&cc->time_max));
 			PC_(CSC_TIME_AVG,
 			    (uint64_t) (ts_float(&cc->time_avg) * 1e6));
+			PC_(CSC_TIME_P50,
+			    ts_float(&cc->time_pct[PCT_IDX(CSC_TIME_P50)]));
+			PC_(CSC_TIME_P90,
+			    ts_float(&cc->time_pct[PCT_IDX(CSC_TIME_P90)]));
+			PC_(CSC_TIME_P99,
+			    ts_float(&cc->time_pct[PCT_IDX(CSC_TIME_P99)]));
+			PC_(CSC_TIME_P999,
+			    ts_float(&cc->time_pct[PCT_IDX(CSC_TIME_P999)]));
 			PC_(CSC_CALLS,      cc->calls);
 			PC_(CSC_ERRORS,     cc->errors);
 			PC_(CSC_SC_NAME,    sysent[idx].sys_name);
@@ -466,8 +912,6 @@ call_summary_pers(FILE *outf)
 		fputc('\n', outf);
 	}
 
-	free(indices);
-
 	/* footer */
 	for (size_t i = 0; i <= last_column; ++i) {
 		if (i)
@@ -490,6 +934,10 @@ call_summary_pers(FILE *outf)
 		PC_(CSC_TIME_MIN, ts_float(tv_min));
 		PC_(CSC_TIME_MAX, ts_float(tv_max));
 		PC_(CSC_TIME_AVG, (uint64_t) (float_tv_cum / call_cum * 1e6));
+		PC_(CSC_TIME_P50, ts_float(&tv_pct[PCT_IDX(CSC_TIME_P50)]));
+		PC_(CSC_TIME_P90, ts_float(&tv_pct[PCT_IDX(CSC_TIME_P90)]));
+		PC_(CSC_TIME_P99, ts_float(&tv_pct[PCT_IDX(CSC_TIME_P99)]));
+		PC_(CSC_TIME_P999, ts_float(&tv_pct[PCT_IDX(CSC_TIME_P999)]));
 		PC_(CSC_CALLS, call_cum);
 		PC_(CSC_ERRORS, error_cum);
 		PC_(CSC_SC_NAME, "total");
@@ -499,6 +947,285 @@ call_summary_pers(FILE *outf)
 
 #undef PC_
 #undef FC_
+
+	if (count_histogram) {
+		for (size_t j = 0; j < nsyscalls; ++j) {
+			const unsigned int idx = indices[j];
+
+			if (counts[idx].calls && counts[idx].hist)
+				print_histogram(outf, sysent[idx].sys_name,
+						counts[idx].hist,
+						counts[idx].calls);
+		}
+	}
+
+	free(indices);
+}
+
+static void
+call_summary_json_pers(FILE *fp, bool *first)
+{
+	for (size_t i = 0; i < nsyscalls; ++i) {
+		struct call_counts *cc = &counts[i];
+
+		if (cc->calls == 0)
+			continue;
+
+		fprintf(fp, "%s{\"personality\":\"%s\",\"name\":\"%s\""
+			",\"calls\":%" PRIu64 ",\"errors\":%" PRIu64
+			",\"seconds\":%.6f,\"min\":%.6f,\"max\":%.6f",
+			*first ? "" : ",", personality_names[current_personality],
+			sysent[i].sys_name, cc->calls, cc->errors,
+			ts_float(&cc->time), ts_float(&cc->time_min),
+			ts_float(&cc->time_max));
+		*first = false;
+
+		if (cc->hist) {
+			hist_percentiles(cc->hist, cc->calls, &cc->time_min,
+					 &cc->time_max, cc->time_pct);
+			for (size_t j = 0; j < ARRAY_SIZE(percentiles); ++j) {
+				fprintf(fp, ",\"p%u\":%.6f",
+					percentiles[j] % 10
+					? percentiles[j] : percentiles[j] / 10,
+					ts_float(&cc->time_pct[j]));
+			}
+		}
+
+		fputc('}', fp);
+	}
+}
+
+static bool
+counts_are_empty(void)
+{
+	for (size_t i = 0; i < nsyscalls; ++i) {
+		if (counts[i].calls)
+			return false;
+	}
+
+	return true;
+}
+
+/* Add the counts of the interval to the totals, and reset them. */
+static void
+add_counts_to_totals(void)
+{
+	struct call_counts **const totals = &totalv[current_personality];
+
+	if (!*totals) {
+		*totals = xcalloc(nsyscalls, sizeof(**totals));
+
+		for (size_t i = 0; i < nsyscalls; i++)
+			(*totals)[i].time_min = max_ts;
+	}
+
+	for (size_t i = 0; i < nsyscalls; ++i) {
+		struct call_counts *cc = &counts[i];
+		struct call_counts *tc = &(*totals)[i];
+
+		if (cc->calls == 0)
+			continue;
+
+		ts_add(&tc->time, &tc->time, &cc->time);
+		tc->time_min = *ts_min(&tc->time_min, &cc->time_min);
+		tc->time_max = *ts_max(&tc->time_max, &cc->time_max);
+		tc->calls += cc->calls;
+		tc->errors += cc->errors;
+
+		cc->time = zero_ts;
+		cc->time_min = max_ts;
+		cc->time_max = zero_ts;
+		cc->calls = cc->errors = 0;
+
+		if (cc->hist) {
+			if (!tc->hist)
+				tc->hist = xcalloc(HIST_BUCKETS,
+						   sizeof(*tc->hist));
+			for (size_t j = 0; j < HIST_BUCKETS; ++j)
+				tc->hist[j] += cc->hist[j];
+			memset(cc->hist, 0, HIST_BUCKETS * sizeof(*cc->hist));
+		}
+	}
+}
+
+void
+start_call_summary_intervals(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	interval_start_ts = start_ts;
+	intervals_started = true;
+}
+
+void
+call_interval_summary(FILE *outf, FILE *json)
+{
+	unsigned int old_pers = current_personality;
+	struct timespec now, from, to, realtime;
+	bool first = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&from, &interval_start_ts, &start_ts);
+	ts_sub(&to, &now, &start_ts);
+	interval_start_ts = now;
+
+	fprintf(outf, "System call usage summary for %.3f to %.3f seconds:\n",
+		ts_float(&from), ts_float(&to));
+
+	if (json) {
+		clock_gettime(CLOCK_REALTIME, &realtime);
+		fprintf(json, "{\"time\":%.6f,\"start\":%.6f,\"end\":%.6f"
+			",\"syscalls\":[",
+			ts_float(&realtime), ts_float(&from), ts_float(&to));
+	}
+
+	for (unsigned int i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
+		if (!countv[i])
+			continue;
+
+		if (current_personality != i)
+			set_personality(i);
+		if (counts_are_empty())
+			continue;
+		if (i)
+			fprintf(outf,
+				"System call usage summary for %s mode:\n",
+				personality_names[i]);
+		call_summary_pers(outf);
+		if (json)
+			call_summary_json_pers(json, &first);
+		add_counts_to_totals();
+	}
+
+	if (json) {
+		fputs("]}\n", json);
+		fflush(json);
+	}
+
+	if (old_pers != current_personality)
+		set_personality(old_pers);
+}
+
+static int
+group_time_cmp(const void *a, const void *b)
+{
+	return -ts_cmp(&groups[*(const unsigned int *) a].time,
+		       &groups[*(const unsigned int *) b].time);
+}
+
+static int
+group_counts_cmp(const void *a, const void *b)
+{
+	const struct group_counts *const *ga = a;
+	const struct group_counts *const *gb = b;
+
+	if ((*ga)->group != (*gb)->group)
+		return (*ga)->group < (*gb)->group ? -1 : 1;
+	return ((*ga)->pers > (*gb)->pers) - ((*ga)->pers < (*gb)->pers);
+}
+
+/*
+ * Print the summaries of the groups with the longest total time.
+ * The counts of a group are expanded into a temporary table of all
+ * syscalls just for printing it.  Histograms are not kept per group,
+ * so percentile columns are omitted, and the syscalls are sorted by time
+ * if they would be sorted by a percentile.
+ */
+static void
+group_summary(FILE *outf)
+{
+	if (!groups_used)
+		return;
+
+	const size_t n = group_counts_used;
+	unsigned int *order = xcalloc(groups_used, sizeof(*order));
+	struct group_counts **entries = xcalloc(n, sizeof(*entries));
+	size_t *first = xcalloc(groups_used + 1, sizeof(*first));
+
+	for (size_t i = 0; i < groups_used; ++i)
+		order[i] = i;
+	qsort(order, groups_used, sizeof(*order), group_time_cmp);
+
+	for (size_t i = 0; i < n; ++i)
+		entries[i] = &group_counts[i];
+	qsort(entries, n, sizeof(*entries), group_counts_cmp);
+
+	/* Index of the first entry of every group. */
+	for (size_t i = 0, g = 0; g <= groups_used; ++g) {
+		while (i < n && entries[i]->group < g)
+			++i;
+		first[g] = i;
+	}
+
+	uint8_t saved_columns[CSC_MAX];
+	size_t cur = 0;
+
+	memcpy(saved_columns, columns, sizeof(columns));
+	memset(columns, 0, sizeof(columns));
+	for (size_t i = 0; i < CSC_MAX; ++i) {
+		if (!IS_PCT_COLUMN(saved_columns[i]))
+			columns[cur++] = saved_columns[i];
+	}
+
+	/* Percentiles of groups are all zero, sort them by time instead. */
+	const sort_func saved_sortfun = sortfun;
+
+	if (sortfun == p50_time_cmp || sortfun == p90_time_cmp
+	    || sortfun == p99_time_cmp || sortfun == p999_time_cmp)
+		sortfun = time_cmp;
+
+	const size_t top = summary_top ? MIN(summary_top, groups_used)
+				       : groups_used;
+
+	fprintf(outf, "\nSystem call usage summary by %s,"
+		" %zu of %zu groups with the longest total time:\n",
+		summary_by_names[summary_by], top, groups_used);
+
+	for (size_t j = 0; j < top; ++j) {
+		const struct count_group *g = &groups[order[j]];
+
+		if (summary_by == CSB_COMM)
+			fprintf(outf, "\ncomm %s:\n", g->comm);
+		else
+			fprintf(outf, "\n%s %d (%s):\n",
+				summary_by_names[summary_by], g->id, g->comm);
+
+		for (size_t i = first[order[j]]; i < first[order[j] + 1]; ) {
+			const unsigned int pers = entries[i]->pers;
+
+			if (current_personality != pers)
+				set_personality(pers);
+
+			struct call_counts *const saved_counts = counts;
+			counts = xcalloc(nsyscalls, sizeof(*counts));
+
+			for (; i < first[order[j] + 1]
+			       && entries[i]->pers == pers; ++i) {
+				const struct group_counts *gc = entries[i];
+				struct call_counts *cc = &counts[gc->scno];
+
+				cc->time = gc->time;
+				cc->time_min = gc->time_min;
+				cc->time_max = gc->time_max;
+				cc->calls = gc->calls;
+				cc->errors = gc->errors;
+			}
+
+			if (pers)
+				fprintf(outf,
+					"System call usage summary for %s mode:\n",
+					personality_names[pers]);
+			call_summary_pers(outf);
+
+			free(counts);
+			counts = saved_counts;
+		}
+	}
+
+	sortfun = saved_sortfun;
+	memcpy(columns, saved_columns, sizeof(columns));
+	free(first);
+	free(entries);
+	free(order);
 }
 
 void
@@ -506,12 +1233,25 @@ call_summary(FILE *outf)
 {
 	unsigned int i, old_pers = current_personality;
 
+	if (intervals_started)
+		fputs("System call usage summary for the whole run:\n", outf);
+
 	for (i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
 		if (!countv[i])
 			continue;
 
 		if (current_personality != i)
 			set_personality(i);
+
+		/* Summarise the whole run rather than the last interval. */
+		if (totalv[i]) {
+			struct call_counts *const interval = countv[i];
+
+			add_counts_to_totals();
+			countv[i] = totalv[i];
+			totalv[i] = interval;
+		}
+
 		if (i)
 			fprintf(outf,
 				"System call usage summary for %s mode:\n",
@@ -519,6 +1259,11 @@ call_summary(FILE *outf)
 		call_summary_pers(outf);
 	}
 
+	group_summary(outf);
+
 	if (old_pers != current_personality)
 		set_personality(old_pers);
+
+	if (io_summary_enabled)
+		print_io_summary(outf);
 }
@@ -261,7 +261,9 @@ struct tcb {
 	int sys_func_rval;	/* Syscall entry parser's return value */
 	int curcol;		/* Output column for this process */
 	FILE *outf;		/* Output file for this process */
-	struct staged_output_data *staged_output_data;
+	char *outbuf;		/* Output not written to outf yet */
+	size_t outbuf_len;	/* Length of the output in outbuf */
+	size_t outbuf_size;	/* Allocated size of outbuf */
 
 	const char *auxstr;	/* Auxiliary info from syscall (see RVAL_STR) */
 	void *_priv_data;	/* Private data for syscall decoding functions */
@@ -278,6 +280,9 @@ struct tcb {
 	struct timespec delay_expiration_time; /* When does the delay end */
 
 	struct mmap_cache_t *mmap_cache;
+	unsigned int mmap_cache_generation; /* Last seen mmap_cache generation */
+	struct fd_cache *fd_cache;	/* Cached paths of descriptors */
+	unsigned int count_group; /* --summary-by group plus 1, 0 if unknown */
 
 	/*
 	 * Data that is stored during process wait traversal.
@@ -335,6 +340,9 @@ struct tcb {
 # define TCB_SECCOMP_FILTER	0x8000	/* This process has a seccomp filter
 					 * attached.
 					 */
+# define TCB_STAGED_OUTPUT	0x10000	/* The output is staged in outbuf
+					 * until the syscall status is known.
+					 */
 
 /* qualifier flags */
 # define QUAL_TRACE	0x001	/* this system call should be traced */
@@ -464,8 +472,11 @@ extern cflag_t cflag;
 extern bool Tflag;
 extern int Tflag_scale;
 extern int Tflag_width;
+extern struct timespec latency_threshold;
 extern bool iflag;
 extern bool count_wallclock;
+extern bool count_histogram;
+extern bool io_summary_enabled;
 /* are we filtering traces based on paths? */
 extern struct path_set {
 	const char **paths_selected;
@@ -486,8 +497,11 @@ extern bool output_separately;
 # ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 extern bool stack_trace_enabled;
+/* if this is true count the stack traces instead of printing them */
+extern bool stack_profile_enabled;
 # else
 #  define stack_trace_enabled 0
+#  define stack_profile_enabled 0
 # endif
 extern unsigned ptrace_setoptions;
 extern unsigned max_strlen;
@@ -503,6 +517,9 @@ extern void set_count_summary_columns(const char *columns);
 
 extern bool get_instruction_pointer(struct tcb *, kernel_ulong_t *);
 extern bool get_stack_pointer(struct tcb *, kernel_ulong_t *);
+/* Registers for frame pointer unwinding, false if the arch has none. */
+extern bool get_frame_pointer(struct tcb *, kernel_ulong_t *);
+extern bool get_link_register(struct tcb *, kernel_ulong_t *);
 extern void print_instruction_pointer(struct tcb *);
 
 extern void print_syscall_resume(struct tcb *tcp);
@@ -517,6 +534,12 @@ extern void syscall_exiting_finish(struct tcb *);
 
 extern void count_syscall(struct tcb *, const struct timespec *);
 extern void call_summary(FILE *);
+extern int set_count_summary_by(const char *);
+extern void set_count_summary_top(unsigned int);
+extern void start_call_summary_intervals(void);
+extern void call_interval_summary(FILE *, FILE *json);
+extern void count_io_syscall(struct tcb *, const struct timespec *);
+extern void print_io_summary(FILE *);
 
 extern void clear_regs(struct tcb *tcp);
 extern int get_scno(struct tcb *);
@@ -658,8 +681,27 @@ umoven_or_printaddr_ignore_syserror(struct tcb *tcp, const kernel_ulong_t addr,
 extern int
 umovestr(struct tcb *, kernel_ulong_t addr, unsigned int len, char *laddr);
 
+/** A range of tracee memory to fetch with umoven_iov.  */
+struct umove_iov {
+	kernel_ulong_t addr;
+	unsigned int len;
+};
+
+/**
+ * Fetches cnt ranges of tracee memory and places them one after another
+ * at laddr, using as few syscalls as possible.
+ *
+ * @return The number of leading ranges that have been fetched entirely,
+ *         the rest should be fetched with umoven.
+ */
+extern unsigned int
+umoven_iov(struct tcb *, const struct umove_iov *riov, unsigned int cnt,
+	   void *laddr);
+
 /* Invalidate the cache used by umove* functions.  */
 extern void invalidate_umove_cache(void);
+/* Print statistics of the cache used by umove* functions in debug mode.  */
+extern void print_umove_cache_stats(void);
 
 extern int upeek(struct tcb *tcp, unsigned long, kernel_ulong_t *);
 extern int upoke(struct tcb *tcp, unsigned long, kernel_ulong_t);
@@ -686,6 +728,13 @@ pathtrace_match(struct tcb *tcp)
 }
 
 extern int getfdpath(struct tcb *, int, char *, unsigned);
+extern int get_proc_tgid(int pid);
+/*
+ * Fetch the flags of the clone or clone3 syscall of the tracee.
+ * Returns false if they cannot be fetched.
+ */
+extern bool fetch_clone_flags(struct tcb *, uint64_t *flags);
+extern void get_proc_comm(int pid, char *comm, size_t size);
 extern unsigned long getfdinode(struct tcb *, int);
 extern enum sock_proto getfdproto(struct tcb *, int);
 
@@ -1043,6 +1092,8 @@ extern void print_ax25_addr(const void /* ax25_address */ *addr);
 extern void print_x25_addr(const void /* struct x25_address */ *addr);
 extern const char *get_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
 extern bool print_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
+/* Invalidate the socket details the current syscall might change.  */
+extern void sockaddr_cache_syscall(struct tcb *);
 extern void print_dirfd(struct tcb *, int);
 
 extern int
@@ -1248,11 +1299,18 @@ extern const struct timespec *ts_max(const struct timespec *, const struct times
 extern int parse_ts(const char *s, struct timespec *t);
 
 # ifdef ENABLE_STACKTRACE
+extern bool unwind_set_unwinder(const char *name);
 extern void unwind_init(void);
 extern void unwind_tcb_init(struct tcb *);
 extern void unwind_tcb_fin(struct tcb *);
 extern void unwind_tcb_print(struct tcb *);
 extern void unwind_tcb_capture(struct tcb *);
+extern bool unwind_tcb_print_pending(const struct tcb *);
+extern void unwind_tcb_print_deferred(struct tcb *);
+extern void unwind_tcb_discard(struct tcb *);
+extern void unwind_print_stats(void);
+extern void unwind_tcb_profile(struct tcb *, const struct timespec *);
+extern void unwind_profile_print(FILE *, bool weight_by_time);
 # endif
 
 # ifdef HAVE_LINUX_KVM_H
@@ -1394,6 +1452,13 @@ extern void print_user_desc(struct tcb *, kernel_ulong_t addr,
  * printleader(tcp) examines it, finishes incomplete line if needed,
  * the sets it to tcp.
  * line_ended() clears printing_tcp and resets ->curcol = 0.
+ * Output is accumulated in tcp->outbuf; flush_tcp_output(tcp) writes it
+ * to tcp->outf, and has to be called before anything is written
+ * to tcp->outf directly.  While TCB_STAGED_OUTPUT is set, the output
+ * stays in tcp->outbuf until publish_tcp_output(tcp) lets it out
+ * or discard_tcp_output(tcp) drops it.
+ * defer_tcp_output_flush(tcp) arranges tcp->outf to be flushed after
+ * the tracee is restarted; line_ended() uses it for the current tcb.
  * tcp->curcol == 0 check is also used to detect completeness
  * of last line, since in -ff mode just checking printing_tcp for NULL
  * is not enough.
@@ -1407,17 +1472,30 @@ extern void print_user_desc(struct tcb *, kernel_ulong_t addr,
 extern struct tcb *printing_tcp;
 extern void printleader(struct tcb *);
 extern void line_ended(void);
+extern void flush_tcp_output(struct tcb *);
+extern void publish_tcp_output(struct tcb *);
+extern void discard_tcp_output(struct tcb *);
+extern void defer_tcp_output_flush(struct tcb *);
 extern void tabto(void);
 extern void tprintf(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2));
 extern void tprints(const char *str);
+/*
+ * Print integers the way "%" PRId64, "%" PRIu64, and "%#" PRIx64 do,
+ * without the overhead of parsing a format string.
+ */
+extern void tprint_int64(int64_t);
+extern void tprint_uint64(uint64_t);
+extern void tprint_xint64(uint64_t);
 extern void tprintf_comment(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2));
 extern void tprints_comment(const char *str);
 
 /*
  * Staging output for status qualifier.
  */
-extern FILE *strace_open_memstream(struct tcb *tcp);
-extern void strace_close_memstream(struct tcb *tcp, bool publish);
+extern void strace_open_staged_output(struct tcb *tcp);
+extern void strace_close_staged_output(struct tcb *tcp, bool publish);
+extern bool syscall_output_staged(void);
+extern bool syscall_latency_exceeded(struct tcb *, const struct timespec *);
 
 static inline void
 printaddr_comment(const kernel_ulong_t addr)
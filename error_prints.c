@@ -26,6 +26,7 @@ verror_msg(int err_no, const char *fmt, va_list p)
 {
 	char *msg;
 
+	flush_tracee_output();
 	fflush(NULL);
 
 	/* We want to print entire message with single fprintf to ensure
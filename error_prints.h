@@ -1,8 +1,8 @@
 /*
  * This file contains error printing functions.
  * These functions can be used by various binaries included in the strace
- * package.  Variable 'program_invocation_name' and function 'die()'
- * have to be defined globally.
+ * package.  Variable 'program_invocation_name' and functions 'die()'
+ * and 'flush_tracee_output()' have to be defined globally.
  *
  * Copyright (c) 2001-2018 The strace developers.
  * All rights reserved.
@@ -20,6 +20,8 @@
 extern bool debug_flag;
 
 void die(void) ATTRIBUTE_NORETURN;
+/* Write out the output buffered outside stdio before printing a message. */
+void flush_tracee_output(void);
 
 void error_msg(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2));
 void perror_msg(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2));
@@ -0,0 +1,286 @@
+/*
+ * Caching of fd paths.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Paths of file descriptors obtained from /proc/PID/fd/FD are cached
+ * per file descriptor table, so that -y and -P do not have to call
+ * readlink every time a descriptor is printed or matched.  The threads
+ * of a process share its table, and so do they share its cache.
+ *
+ * A cached path is valid until a traced syscall that might close
+ * a descriptor completes in one of the tracees sharing the table,
+ * which bumps the generation of the cache of that table only, or until
+ * a traced syscall that might change the path of an open file completes
+ * in any of the tracees, which bumps fd_cache_global_generation and thus
+ * invalidates all the caches.  Descriptors that could not be resolved
+ * are not cached, so syscalls that only create descriptors do not need
+ * to invalidate anything.
+ *
+ * The syscalls of tracees are not always seen: seccomp-bpf filtering
+ * does not stop the tracee on syscalls that are not traced, and without
+ * -f the tracee may have untraced threads sharing its descriptors.
+ * In these cases paths are cached only for the duration of a syscall
+ * stop.  Processes other than threads may share a table, too,
+ * if created by clone with CLONE_FILES; as there is no telling which
+ * tracees share the table of such a process, every syscall that might
+ * close a descriptor invalidates all the caches once such a process
+ * is created.  Conversely, threads may have descriptor tables of their
+ * own, if created without CLONE_FILES or after unshare(CLONE_FILES);
+ * once such a thread is seen, paths are cached only for the duration
+ * of a syscall stop, too.  Changes made by other processes (e.g. renaming an open
+ * file) cannot be seen either, so cached paths are also re-read from
+ * /proc after FD_CACHE_MAX_HITS lookups.
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <sched.h>
+#include "fd_cache.h"
+#include "filter_seccomp.h"
+#include "syscall.h"
+
+enum {
+	/* Do not cache paths of descriptors with larger numbers.  */
+	FD_CACHE_MAX_FD = 1 << 16,
+	/* Re-read the path from /proc after that many lookups.  */
+	FD_CACHE_MAX_HITS = 64,
+};
+
+struct fd_cache_entry {
+	char *path;
+	unsigned int len;		/* Length of the path.  */
+	unsigned int size;		/* Allocated size of the path.  */
+	unsigned int generation;	/* Zero if the entry is unused.  */
+	unsigned int hits;
+};
+
+struct fd_cache {
+	struct fd_cache *next;
+	struct fd_cache_entry *entry;
+	size_t size;
+	int tgid;
+	unsigned int refcount;
+	unsigned int generation;
+	/* fd_cache_global_generation the entries are valid for.  */
+	unsigned int global_generation;
+};
+
+/* All the caches, looked up by thread group id.  */
+static struct fd_cache *fd_caches;
+static unsigned int fd_cache_global_generation = 1;
+/* A process sharing descriptors with another one has been created.  */
+static bool fd_cache_shared_tables;
+/* A thread not sharing descriptors with its process has been created.  */
+static bool fd_cache_split_tables;
+
+static void
+bump_generation(unsigned int *const generation)
+{
+	if (!++*generation)
+		*generation = 1;
+}
+
+/* Attach the tracee to the cache of its descriptor table.  */
+static struct fd_cache *
+get_fd_cache(struct tcb *const tcp)
+{
+	if (tcp->fd_cache)
+		return tcp->fd_cache;
+
+	const int tgid = get_proc_tgid(tcp->pid);
+	struct fd_cache *c;
+
+	for (c = fd_caches; c; c = c->next) {
+		if (c->tgid == tgid)
+			break;
+	}
+
+	if (!c) {
+		c = xzalloc(sizeof(*c));
+		c->tgid = tgid;
+		c->generation = 1;
+		c->global_generation = fd_cache_global_generation;
+		c->next = fd_caches;
+		fd_caches = c;
+	}
+
+	++c->refcount;
+	tcp->fd_cache = c;
+
+	return c;
+}
+
+static void
+fd_cache_invalidate(struct tcb *const tcp)
+{
+	if (fd_cache_shared_tables)
+		bump_generation(&fd_cache_global_generation);
+	else
+		bump_generation(&get_fd_cache(tcp)->generation);
+}
+
+static bool
+fd_cache_is_valid(const struct fd_cache *const c)
+{
+	return c->global_generation == fd_cache_global_generation;
+}
+
+int
+fd_cache_lookup(struct tcb *const tcp, const int fd, char *const buf,
+		const unsigned int bufsize)
+{
+	const struct fd_cache *const c = tcp->fd_cache;
+
+	if (!c || fd < 0 || (size_t) fd >= c->size || !fd_cache_is_valid(c))
+		return -1;
+
+	struct fd_cache_entry *const e = &c->entry[fd];
+
+	if (e->generation != c->generation || ++e->hits > FD_CACHE_MAX_HITS)
+		return -1;
+
+	const unsigned int len = MIN(e->len, bufsize - 1);
+
+	memcpy(buf, e->path, len);
+	buf[len] = '\0';
+	return len;
+}
+
+void
+fd_cache_store(struct tcb *const tcp, const int fd, const char *const path,
+	       const unsigned int len)
+{
+	if (fd < 0 || fd >= FD_CACHE_MAX_FD)
+		return;
+
+	struct fd_cache *const c = get_fd_cache(tcp);
+
+	if (!fd_cache_is_valid(c)) {
+		bump_generation(&c->generation);
+		c->global_generation = fd_cache_global_generation;
+	}
+
+	if ((size_t) fd >= c->size) {
+		const size_t old_size = c->size;
+
+		while ((size_t) fd >= c->size)
+			c->entry = xgrowarray(c->entry, &c->size,
+					      sizeof(*c->entry));
+		memset(c->entry + old_size, 0,
+		       (c->size - old_size) * sizeof(*c->entry));
+	}
+
+	struct fd_cache_entry *const e = &c->entry[fd];
+
+	if (e->size <= len) {
+		free(e->path);
+		e->path = xmalloc(len + 1);
+		e->size = len + 1;
+	}
+	memcpy(e->path, path, len);
+	e->path[len] = '\0';
+	e->len = len;
+	e->generation = c->generation;
+	e->hits = 0;
+}
+
+void
+fd_cache_syscall(struct tcb *const tcp)
+{
+	if (seccomp_filtering || !followfork || fd_cache_split_tables) {
+		bump_generation(&fd_cache_global_generation);
+		return;
+	}
+
+	const unsigned int sen = tcp_sysent(tcp)->sen;
+
+	if (entering(tcp)) {
+		uint64_t flags;
+
+		switch (sen) {
+		case SEN_clone:
+		case SEN_clone3:
+			if (!fetch_clone_flags(tcp, &flags)) {
+				fd_cache_split_tables = true;
+				break;
+			}
+			switch (flags & (CLONE_FILES | CLONE_THREAD)) {
+			case CLONE_FILES:
+				fd_cache_shared_tables = true;
+				break;
+			case CLONE_THREAD:
+				fd_cache_split_tables = true;
+				break;
+			}
+			break;
+		case SEN_unshare:
+			if (tcp->u_arg[0] & CLONE_FILES)
+				fd_cache_split_tables = true;
+			break;
+		}
+		return;
+	}
+
+	switch (sen) {
+	/* Syscalls that close descriptors.  */
+	case SEN_close:
+	case SEN_dup:
+	case SEN_dup2:
+	case SEN_dup3:
+	case SEN_execve:
+	case SEN_execveat:
+	case SEN_io_uring_enter:
+		fd_cache_invalidate(tcp);
+		break;
+	case SEN_fcntl:
+	case SEN_fcntl64:
+		if (tcp->u_arg[1] == F_DUPFD || tcp->u_arg[1] == F_DUPFD_CLOEXEC)
+			fd_cache_invalidate(tcp);
+		break;
+	/* Syscalls that change paths of open files.  */
+	case SEN_mount:
+	case SEN_move_mount:
+	case SEN_pivotroot:
+	case SEN_rename:
+	case SEN_renameat:
+	case SEN_renameat2:
+	case SEN_rmdir:
+	case SEN_umount:
+	case SEN_umount2:
+	case SEN_unlink:
+	case SEN_unlinkat:
+		bump_generation(&fd_cache_global_generation);
+		break;
+	}
+}
+
+void
+fd_cache_free(struct tcb *const tcp)
+{
+	struct fd_cache *const c = tcp->fd_cache;
+
+	if (!c)
+		return;
+
+	tcp->fd_cache = NULL;
+	if (--c->refcount)
+		return;
+
+	for (struct fd_cache **p = &fd_caches; *p; p = &(*p)->next) {
+		if (*p == c) {
+			*p = c->next;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < c->size; ++i)
+		free(c->entry[i].path);
+	free(c->entry);
+	free(c);
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_FD_CACHE_H
+# define STRACE_FD_CACHE_H
+
+/*
+ * Copy the cached path of fd to buf the way readlink would do.
+ * Returns the length of the copied path, or -1 if there is no valid
+ * cached path for fd.
+ */
+extern int fd_cache_lookup(struct tcb *, int fd, char *buf,
+			   unsigned int bufsize);
+/* Remember len bytes of path as the path of fd.  */
+extern void fd_cache_store(struct tcb *, int fd, const char *path,
+			   unsigned int len);
+/* Invalidate the cached paths the current syscall might change.  */
+extern void fd_cache_syscall(struct tcb *);
+extern void fd_cache_free(struct tcb *);
+
+#endif /* !STRACE_FD_CACHE_H */
@@ -0,0 +1,104 @@
+/*
+ * Hash tables indexing arrays of entries.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * The index is kept at most half full, so that linear probing stays short,
+ * and it is only ever grown, as entries are never removed from it one
+ * by one.  The entries stay in the arrays of the callers, where they can
+ * be iterated over in the order they were added.
+ */
+
+#include "defs.h"
+#include "index_table.h"
+
+#define INDEX_TABLE_MIN_SIZE	256U
+
+uint32_t
+hash_bytes(uint32_t hash, const void *buf, size_t len)
+{
+	for (const unsigned char *p = buf; len; --len, ++p)
+		hash = (hash ^ *p) * 16777619U;
+	return hash;
+}
+
+uint32_t
+hash_string(uint32_t hash, const char *s)
+{
+	return hash_bytes(hash, s, strlen(s));
+}
+
+static struct index_slot *
+index_table_find_empty(const struct index_table *t, const uint32_t hash)
+{
+	size_t i = hash & (t->size - 1);
+
+	while (t->slots[i].num)
+		i = (i + 1) & (t->size - 1);
+
+	return &t->slots[i];
+}
+
+static void
+index_table_grow(struct index_table *t)
+{
+	struct index_slot *const old_slots = t->slots;
+	const size_t old_size = t->size;
+
+	t->size = old_size ? old_size * 2 : INDEX_TABLE_MIN_SIZE;
+	t->slots = xcalloc(t->size, sizeof(*t->slots));
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (old_slots[i].num)
+			*index_table_find_empty(t, old_slots[i].hash) =
+				old_slots[i];
+	}
+
+	free(old_slots);
+}
+
+unsigned int
+index_table_lookup(const struct index_table *t, const uint32_t hash,
+		   index_table_match_fn match, const void *key)
+{
+	if (!t->used)
+		return INDEX_TABLE_NONE;
+
+	for (size_t i = hash & (t->size - 1); t->slots[i].num;
+	     i = (i + 1) & (t->size - 1)) {
+		const struct index_slot *s = &t->slots[i];
+
+		if (s->hash == hash && match(s->num - 1, key))
+			return s->num - 1;
+	}
+
+	return INDEX_TABLE_NONE;
+}
+
+void
+index_table_add(struct index_table *t, const uint32_t hash,
+		const unsigned int num)
+{
+	if ((t->used + 1) * 2 > t->size)
+		index_table_grow(t);
+
+	*index_table_find_empty(t, hash) = (struct index_slot) {
+		.hash = hash,
+		.num = num + 1,
+	};
+	++t->used;
+}
+
+void
+index_table_clear(struct index_table *t)
+{
+	if (t->used) {
+		memset(t->slots, 0, t->size * sizeof(*t->slots));
+		t->used = 0;
+	}
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_INDEX_TABLE_H
+# define STRACE_INDEX_TABLE_H
+
+/* The initial value of FNV-1a hashes.  */
+# define HASH_INIT	2166136261U
+
+/* Add len bytes of buf to the FNV-1a hash.  */
+extern uint32_t hash_bytes(uint32_t hash, const void *buf, size_t len);
+/* Add the string s, without its terminating null byte, to the hash.  */
+extern uint32_t hash_string(uint32_t hash, const char *s);
+
+/*
+ * An index of an array of entries kept by the caller: an open addressing
+ * hash table of entry numbers.  The index keeps the hashes of the entries,
+ * and compares keys with the entries using a callback, so the entries
+ * do not have to be hashed again when the index grows.
+ * A zero-initialized index is empty.
+ */
+struct index_table {
+	struct index_slot {
+		uint32_t hash;
+		/* Entry number plus 1, 0 if the slot is empty.  */
+		unsigned int num;
+	} *slots;
+	size_t size;
+	size_t used;
+};
+
+# define INDEX_TABLE_NONE	-1U
+
+/* Returns true if the entry number num has the given key.  */
+typedef bool (*index_table_match_fn)(unsigned int num, const void *key);
+
+/*
+ * Returns the number of the entry with the given hash that has the key,
+ * or INDEX_TABLE_NONE if there is no such entry in the index.
+ */
+extern unsigned int index_table_lookup(const struct index_table *,
+				       uint32_t hash, index_table_match_fn,
+				       const void *key);
+/* Add the entry number num, which is not in the index, to the index.  */
+extern void index_table_add(struct index_table *, uint32_t hash,
+			    unsigned int num);
+/* Remove all entries from the index.  */
+extern void index_table_clear(struct index_table *);
+
+#endif /* !STRACE_INDEX_TABLE_H */
@@ -0,0 +1,222 @@
+/*
+ * I/O summary: syscall counts, bytes, and time by file or socket.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Syscalls that read or write data are attributed to the targets of their
+ * descriptors, that is, to the paths of descriptors as read from
+ * /proc/PID/fd/FD, so that the descriptors of the same file or socket
+ * in different tracees, or reopened, are counted together.  The path is
+ * obtained with getfdpath, which caches it, and the targets are indexed
+ * by the path, so accounting a syscall does not involve any syscalls
+ * of strace most of the time.
+ * Sockets are resolved to their protocol details only once, when their
+ * first syscall is counted, as they may be gone by the time the summary
+ * is printed.
+ */
+
+#include "defs.h"
+#include "index_table.h"
+#include "syscall.h"
+#include "xstring.h"
+
+struct io_target {
+	char *path;
+	/* Socket details, or path. */
+	const char *name;
+	struct timespec time;
+	uint64_t calls, errors;
+	uint64_t bytes_read, bytes_written;
+};
+
+static struct io_target *targets;
+static size_t targets_size;
+static size_t targets_used;
+static struct index_table target_index;
+
+static bool
+target_matches(const unsigned int num, const void *path)
+{
+	return !strcmp(targets[num].path, path);
+}
+
+static const char *
+get_target_name(struct tcb *tcp, const int fd, const char *path)
+{
+	const char *str = STR_STRIP_PREFIX(path, "socket:[");
+
+	if (str == path)
+		return NULL;
+
+	const unsigned long inode = strtoul(str, NULL, 10);
+
+	return inode ? get_sockaddr_by_inode(tcp, fd, inode) : NULL;
+}
+
+static struct io_target *
+get_target(struct tcb *tcp, const int fd)
+{
+	char path[PATH_MAX + 1];
+
+	if (getfdpath(tcp, fd, path, sizeof(path)) < 0)
+		xsprintf(path, "fd %d", fd);
+
+	const uint32_t hash = hash_string(HASH_INIT, path);
+	unsigned int num = index_table_lookup(&target_index, hash,
+					      target_matches, path);
+
+	if (num == INDEX_TABLE_NONE) {
+		if (targets_used >= targets_size)
+			targets = xgrowarray(targets, &targets_size,
+					     sizeof(*targets));
+
+		struct io_target *const t = &targets[targets_used];
+		const char *name = get_target_name(tcp, fd, path);
+
+		*t = (struct io_target) { .path = xstrdup(path) };
+		t->name = name ? xstrdup(name) : t->path;
+		num = targets_used++;
+		index_table_add(&target_index, hash, num);
+	}
+
+	return &targets[num];
+}
+
+static void
+count_io(struct tcb *tcp, const kernel_ulong_t fd, const bool write,
+	 const struct timespec *ts)
+{
+	struct io_target *const t = get_target(tcp, (int) fd);
+
+	t->calls++;
+	if (syserror(tcp))
+		t->errors++;
+	else if (write)
+		t->bytes_written += tcp->u_rval;
+	else
+		t->bytes_read += tcp->u_rval;
+	ts_add(&t->time, &t->time, ts);
+}
+
+/*
+ * Data moved between descriptors is read from one descriptor and written
+ * to another, but the call is counted only once, for the output descriptor,
+ * so that it is not counted twice in the total.
+ */
+static void
+count_io_copy(struct tcb *tcp, const kernel_ulong_t in_fd,
+	      const kernel_ulong_t out_fd, const struct timespec *ts)
+{
+	if (!syserror(tcp))
+		get_target(tcp, (int) in_fd)->bytes_read += tcp->u_rval;
+	count_io(tcp, out_fd, true, ts);
+}
+
+void
+count_io_syscall(struct tcb *tcp, const struct timespec *ts)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_read:
+	case SEN_pread:
+	case SEN_readv:
+	case SEN_preadv:
+	case SEN_preadv2:
+	case SEN_recv:
+	case SEN_recvfrom:
+	case SEN_recvmsg:
+		count_io(tcp, tcp->u_arg[0], false, ts);
+		break;
+	case SEN_write:
+	case SEN_pwrite:
+	case SEN_writev:
+	case SEN_pwritev:
+	case SEN_pwritev2:
+	case SEN_send:
+	case SEN_sendto:
+	case SEN_sendmsg:
+		count_io(tcp, tcp->u_arg[0], true, ts);
+		break;
+	case SEN_sendfile:
+	case SEN_sendfile64:
+		count_io_copy(tcp, tcp->u_arg[1], tcp->u_arg[0], ts);
+		break;
+	case SEN_tee:
+		count_io_copy(tcp, tcp->u_arg[0], tcp->u_arg[1], ts);
+		break;
+	case SEN_splice:
+	case SEN_copy_file_range:
+		count_io_copy(tcp, tcp->u_arg[0], tcp->u_arg[2], ts);
+		break;
+	}
+}
+
+static int
+target_cmp(const void *a, const void *b)
+{
+	const struct io_target *ta = *(const struct io_target *const *) a;
+	const struct io_target *tb = *(const struct io_target *const *) b;
+	const uint64_t bytes_a = ta->bytes_read + ta->bytes_written;
+	const uint64_t bytes_b = tb->bytes_read + tb->bytes_written;
+	int rc = ts_cmp(&tb->time, &ta->time);
+
+	if (!rc)
+		rc = (bytes_a < bytes_b) - (bytes_a > bytes_b);
+	if (!rc)
+		rc = (ta->calls < tb->calls) - (ta->calls > tb->calls);
+	return rc ? rc : strcmp(ta->name, tb->name);
+}
+
+static void
+print_io_target(FILE *outf, const struct io_target *t,
+		const double total_time)
+{
+	const double time = ts_float(&t->time);
+
+	fprintf(outf, "%6.2f %11.6f %11lu %9" PRIu64 " %9" PRIu64
+		" %11" PRIu64 " %11" PRIu64 " %s\n",
+		total_time > 0 ? time * 100 / total_time : 0.0, time,
+		t->calls ? (unsigned long) (time * 1e6 / t->calls) : 0UL,
+		t->calls, t->errors, t->bytes_read, t->bytes_written,
+		t->name);
+}
+
+void
+print_io_summary(FILE *outf)
+{
+	static const char dashes[] =
+		"------ ----------- ----------- --------- --------- "
+		"----------- ----------- ----------------\n";
+
+	struct io_target **sorted = xcalloc(targets_used ? targets_used : 1,
+					    sizeof(*sorted));
+	struct io_target total = { .name = "total" };
+
+	for (size_t i = 0; i < targets_used; ++i) {
+		sorted[i] = &targets[i];
+		ts_add(&total.time, &total.time, &targets[i].time);
+		total.calls += targets[i].calls;
+		total.errors += targets[i].errors;
+		total.bytes_read += targets[i].bytes_read;
+		total.bytes_written += targets[i].bytes_written;
+	}
+	qsort(sorted, targets_used, sizeof(*sorted), target_cmp);
+
+	const double total_time = ts_float(&total.time);
+
+	fprintf(outf, "\nI/O summary:\n"
+		"%6.6s %11.11s %11.11s %9.9s %9.9s %11.11s %11.11s %s\n",
+		"% time", "seconds", "usecs/call", "calls", "errors",
+		"bytes in", "bytes out", "target");
+	fputs(dashes, outf);
+	for (size_t i = 0; i < targets_used; ++i)
+		print_io_target(outf, sorted[i], total_time);
+	fputs(dashes, outf);
+	print_io_target(outf, &total, total_time);
+
+	free(sorted);
+}
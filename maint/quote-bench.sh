@@ -0,0 +1,92 @@
+#!/bin/sh -efu
+#
+# Compare the cost of quoting strings with the given strace builds.
+#
+# Usage: quote-bench.sh [-n RUNS] [-s SIZE] STRACE...
+#
+# SIZE KiB (4096 by default) of printable text, namely the paths
+# of the files in /usr/include, and of random binary data are copied
+# by dd(1) in 64 KiB blocks, and its write syscalls are traced with -s 65536,
+# so that string_quote is called for every block, in the default style
+# and with -x and -xx.  The time over tracing the same syscalls with
+# -e raw=write, which prints the address instead of the quoted data,
+# is divided by the size of the data.
+#
+# Copyright (c) 2020 The strace developers.
+# All rights reserved.
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+me="${0##*/}"
+
+usage()
+{
+	echo >&2 "usage: $me [-n RUNS] [-s SIZE] STRACE..."
+	exit 1
+}
+
+runs=5
+size=4096
+while [ "$#" -ge 2 ]; do
+	case "$1" in
+		-n) runs="$2" ;;
+		-s) size="$2" ;;
+		*) break ;;
+	esac
+	shift 2
+done
+[ "$#" -ge 1 ] || usage
+
+text="$(mktemp -t "$me.XXXXXX")"
+binary="$(mktemp -t "$me.XXXXXX")"
+trap 'rm -f -- "$text" "$binary"' EXIT
+
+while [ "$(wc -c < "$text")" -lt $((size * 1024)) ]; do
+	find /usr/include -type f >> "$text"
+done
+truncate -s "${size}K" "$text"
+head -c "${size}K" /dev/urandom > "$binary"
+
+now_ns()
+{
+	date +%s%N
+}
+
+# Print the best time of $runs runs of the command, in nanoseconds.
+best_time()
+{
+	best=
+	i=0
+	while [ "$i" -lt "$runs" ]; do
+		start="$(now_ns)"
+		"$@" > /dev/null
+		elapsed=$(($(now_ns) - start))
+		if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+			best="$elapsed"
+		fi
+		i=$((i + 1))
+	done
+	echo "$best"
+}
+
+printf '%-24s %-7s %-7s %10s %12s\n' strace data style 'time, ms' 'ns/byte'
+
+for strace in "$@"; do
+	for data in text binary; do
+		eval "file=\$$data"
+		base="$(best_time "$strace" -qq -e trace=write -e raw=write \
+			-o /dev/null -- \
+			dd if="$file" of=/dev/null bs=64K status=none)"
+		for style in default -x -xx; do
+			[ "$style" = default ] && opt= || opt="$style"
+			t="$(best_time "$strace" -qq -e trace=write -s 65536 \
+				$opt -o /dev/null -- \
+				dd if="$file" of=/dev/null bs=64K status=none)"
+			cost=$(((t > base ? t - base : 0) * 1000 \
+				/ (size * 1024)))
+			printf '%-24s %-7s %-7s %10u %8u.%03u\n' "$strace" \
+				"$data" "$style" $((t / 1000000)) \
+				$((cost / 1000)) $((cost % 1000))
+		done
+	done
+done
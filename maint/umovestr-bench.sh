@@ -0,0 +1,98 @@
+#!/bin/sh -efu
+#
+# Compare the cost of fetching strings from tracees with the given
+# strace builds.
+#
+# Usage: umovestr-bench.sh [-n RUNS] [-d DIR] STRACE...
+#
+# The paths of the files found in DIR (/usr/include by default) are
+# passed to stat(1) by xargs(1), so that the file syscalls fetch
+# paths and execve fetches argv arrays of realistic lengths.  Each set
+# of syscalls is traced with its strings printed and with -e raw=all,
+# which prints the addresses instead of fetching the strings, and the
+# difference is divided by the number of syscalls.
+#
+# Copyright (c) 2020 The strace developers.
+# All rights reserved.
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+me="${0##*/}"
+
+usage()
+{
+	echo >&2 "usage: $me [-n RUNS] [-d DIR] STRACE..."
+	exit 1
+}
+
+runs=5
+dir=/usr/include
+while [ "$#" -ge 2 ]; do
+	case "$1" in
+		-n) runs="$2" ;;
+		-d) dir="$2" ;;
+		*) break ;;
+	esac
+	shift 2
+done
+[ "$#" -ge 1 ] || usage
+
+list="$(mktemp -t "$me.XXXXXX")"
+tmp="$(mktemp -t "$me.XXXXXX")"
+trap 'rm -f -- "$list" "$tmp"' EXIT
+
+find "$dir" -type f -print0 > "$list"
+[ -s "$list" ] || {
+	echo >&2 "$me: no files found in $dir"
+	exit 1
+}
+
+now_ns()
+{
+	date +%s%N
+}
+
+# Print the best time of $runs runs of the command, in nanoseconds.
+best_time()
+{
+	best=
+	i=0
+	while [ "$i" -lt "$runs" ]; do
+		start="$(now_ns)"
+		"$@" > /dev/null
+		elapsed=$(($(now_ns) - start))
+		if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+			best="$elapsed"
+		fi
+		i=$((i + 1))
+	done
+	echo "$best"
+}
+
+printf '%-24s %-8s %10s %10s %14s\n' \
+	strace set syscalls 'time, ms' 'us/syscall'
+
+for strace in "$@"; do
+	for set in %file execve; do
+		"$strace" -f -qq -c -U calls -e trace="$set" -o "$tmp" -- \
+			xargs -0 -a "$list" stat --format=%n > /dev/null
+		calls="$(sed -n \
+			 's/^[[:space:]]*\([0-9]\+\)[[:space:]]\+total$/\1/p' \
+			 "$tmp")"
+		[ "${calls:-0}" -gt 0 ] || {
+			echo >&2 "$me: no $set syscalls counted"
+			exit 1
+		}
+
+		base="$(best_time "$strace" -f -qq -e trace="$set" \
+			-e raw=all -o /dev/null -- \
+			xargs -0 -a "$list" stat --format=%n)"
+		t="$(best_time "$strace" -f -qq -e trace="$set" \
+			-v -s 4096 -o /dev/null -- \
+			xargs -0 -a "$list" stat --format=%n)"
+		cost=$(((t > base ? t - base : 0) / calls))
+		printf '%-24s %-8s %10u %10u %10u.%03u\n' "$strace" \
+			"${set#%}" "$calls" $((t / 1000000)) \
+			$((cost / 1000)) $((cost % 1000))
+	done
+done
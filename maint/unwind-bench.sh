@@ -0,0 +1,96 @@
+#!/bin/sh -efu
+#
+# Compare the cost of obtaining a stack trace with the unwinders
+# of the given strace builds.
+#
+# Usage: unwind-bench.sh [-n RUNS] STRACE... -- COMMAND [ARG]...
+#
+# Only one DWARF unwinder is built into strace, pass a build
+# with libdw and a build with libunwind to compare all of them.
+# For every unwinder, COMMAND is traced with -k and the time
+# it takes over tracing without -k is divided by the number
+# of syscalls COMMAND makes.  Build COMMAND with
+# -fno-omit-frame-pointer to get the fp unwinder to walk the stack
+# rather than to fall back to the DWARF unwinder.
+#
+# Copyright (c) 2020 The strace developers.
+# All rights reserved.
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+me="${0##*/}"
+
+usage()
+{
+	echo >&2 "usage: $me [-n RUNS] STRACE... -- COMMAND [ARG]..."
+	exit 1
+}
+
+runs=5
+if [ "${1-}" = -n ]; then
+	[ "$#" -ge 2 ] || usage
+	runs="$2"
+	shift 2
+fi
+
+stracers=
+while [ "$#" -gt 0 ] && [ "$1" != -- ]; do
+	stracers="$stracers $1"
+	shift
+done
+[ "$#" -ge 2 ] && [ -n "$stracers" ] || usage
+shift
+
+tmp="$(mktemp -t "$me.XXXXXX")"
+trap 'rm -f -- "$tmp"' EXIT
+
+now_ns()
+{
+	date +%s%N
+}
+
+# Print the best time of $runs runs of the command, in nanoseconds.
+best_time()
+{
+	best=
+	i=0
+	while [ "$i" -lt "$runs" ]; do
+		start="$(now_ns)"
+		"$@" > /dev/null
+		elapsed=$(($(now_ns) - start))
+		if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+			best="$elapsed"
+		fi
+		i=$((i + 1))
+	done
+	echo "$best"
+}
+
+printf '%-10s %12s %12s %14s\n' unwinder syscalls 'time, ms' 'us/syscall'
+
+for strace in $stracers; do
+	dwarf="$("$strace" -V |
+		 sed -n 's/.*[[:space:]]stack-trace=\([^[:space:]]*\).*/\1/p')"
+	if [ -z "$dwarf" ]; then
+		echo >&2 "$me: $strace is built without stack trace support"
+		continue
+	fi
+
+	"$strace" -f -qq -c -U calls -o "$tmp" -- "$@" > /dev/null
+	calls="$(sed -n 's/^[[:space:]]*\([0-9]\+\)[[:space:]]\+total$/\1/p' \
+		 "$tmp")"
+	[ "${calls:-0}" -gt 0 ] || {
+		echo >&2 "$me: no syscalls counted"
+		exit 1
+	}
+
+	base="$(best_time "$strace" -f -qq -o /dev/null -- "$@")"
+
+	for unwinder in "$dwarf" fp; do
+		t="$(best_time "$strace" -f -qq -k \
+			--stack-unwinder="$unwinder" -o /dev/null -- "$@")"
+		cost=$(((t > base ? t - base : 0) / calls))
+		printf '%-10s %12u %12u %10u.%03u\n' "$unwinder" "$calls" \
+			$((t / 1000000)) $((cost / 1000)) $((cost % 1000))
+	done
+done
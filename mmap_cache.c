@@ -6,40 +6,120 @@
  */
 
 #include "defs.h"
+#include <dirent.h>
 #include <limits.h>
+#include <sched.h>
 
+#include <linux/mman.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "filter_seccomp.h"
 #include "largefile_wrappers.h"
 #include "mmap_cache.h"
 #include "mmap_notify.h"
+#include "syscall.h"
 #include "xstring.h"
 
+#define XLAT_MACROS_ONLY
+#include "xlat/mmap_flags.h"
+#include "xlat/mmap_prot.h"
+#include "xlat/mremap_flags.h"
+#undef XLAT_MACROS_ONLY
+
+/*
+ * Caching of /proc/PID/maps to speed up stack tracing.
+ *
+ * The cache of an address space is built from /proc/PID/maps and then
+ * updated from arguments and results of syscalls that change memory
+ * mappings: mmap, munmap, mprotect, mremap, and brk.  /proc/PID/maps
+ * is read again only after a syscall whose effect on mappings is unknown.
+ * An execve replaces the address space, so the cache is detached
+ * from the process and a new one is built.
+ *
+ * Syscalls of tracees are not always seen: seccomp-bpf filtering does not
+ * stop the tracee on syscalls that are not traced (stack tracing makes it
+ * stop on all the syscalls that change mappings, but the kvm decoder does
+ * not), without -f the threads of the tracee are not traced, and a process
+ * created by clone with CLONE_VM but without CLONE_THREAD shares
+ * the address space under another thread group id.
+ * In these cases the cache is resynced with /proc/PID/maps
+ * after every syscall; as long as the mappings have not changed,
+ * the generation of the cache is kept and so are the caches of its users.
+ * The child of vfork may change the mappings of its parent, too, so the
+ * cache of the parent is resynced when vfork returns.
+ *
+ * Like /proc/PID/maps parser, the updates keep only named mappings,
+ * anonymous mappings are of no interest to the users of the cache.
+ */
+
+static bool use_mmap_cache;
 static unsigned int mmap_cache_generation;
+static struct mmap_cache_t *mmap_caches;
+/*
+ * An address space is shared with an untraced thread or with a process
+ * of another thread group.
+ */
+static bool mmap_cache_shared_vm;
+
+/* Returns true if the thread group has threads other than the given one.  */
+static bool
+has_other_threads(const int tgid)
+{
+	char path[sizeof("/proc/%u/task") + sizeof(int)*3];
+	xsprintf(path, "/proc/%u/task", tgid);
+
+	DIR *dir = opendir(path);
+	if (!dir)
+		return true;
+
+	unsigned int n = 0;
+	const struct dirent *de;
+
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] != '.')
+			++n;
+	}
+	closedir(dir);
+
+	return n != 1;
+}
 
 static void
-mmap_cache_invalidate(struct tcb *tcp, void *unused)
+free_entries(struct mmap_cache_t *cache)
 {
-#if SUPPORTED_PERSONALITIES > 1
-	if (tcp->currpers != DEFAULT_PERSONALITY) {
-		/* disable stack trace */
-		return;
+	while (cache->size) {
+		unsigned int i = --cache->size;
+		free(cache->entry[i].binary_filename);
+		cache->entry[i].binary_filename = NULL;
 	}
-#endif
-	mmap_cache_generation++;
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p",
-		       tcp->mmap_cache ? tcp->mmap_cache->generation : 0,
-		       mmap_cache_generation, tcp,
-		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0);
 }
 
-void
-mmap_cache_enable(void)
+static void
+invalidate_mmap_cache(struct mmap_cache_t *cache)
+{
+	if (!cache->valid)
+		return;
+
+	free_entries(cache);
+	cache->valid = false;
+	cache->brk = 0;
+	cache->generation = ++mmap_cache_generation;
+}
+
+static void
+unlink_mmap_cache(struct mmap_cache_t *cache)
 {
-	static bool use_mmap_cache;
+	struct mmap_cache_t **p;
 
-	if (!use_mmap_cache) {
-		mmap_notify_register_client(mmap_cache_invalidate, NULL);
-		use_mmap_cache = true;
+	for (p = &mmap_caches; *p; p = &(*p)->next) {
+		if (*p == cache) {
+			*p = cache->next;
+			break;
+		}
 	}
+	cache->next = NULL;
 }
 
 /* deleting the cache */
@@ -51,54 +131,574 @@ delete_mmap_cache(struct tcb *tcp, const char *caller)
 		       mmap_cache_generation, tcp,
 		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0, caller);
 
-	if (!tcp->mmap_cache)
+	struct mmap_cache_t *cache = tcp->mmap_cache;
+
+	if (!cache)
+		return;
+
+	tcp->mmap_cache = NULL;
+	if (--cache->refcount)
 		return;
 
-	while (tcp->mmap_cache->size) {
-		unsigned int i = --tcp->mmap_cache->size;
-		free(tcp->mmap_cache->entry[i].binary_filename);
-		tcp->mmap_cache->entry[i].binary_filename = NULL;
+	unlink_mmap_cache(cache);
+	free_entries(cache);
+	free(cache->entry);
+	free(cache);
+}
+
+/* Attach the tracee to the cache of its address space.  */
+static struct mmap_cache_t *
+get_mmap_cache(struct tcb *tcp)
+{
+	if (tcp->mmap_cache)
+		return tcp->mmap_cache;
+
+	const int tgid = get_proc_tgid(tcp->pid);
+	struct mmap_cache_t *cache;
+
+	for (cache = mmap_caches; cache; cache = cache->next) {
+		if (cache->tgid == tgid)
+			break;
 	}
 
-	free(tcp->mmap_cache->entry);
-	tcp->mmap_cache->entry = NULL;
+	if (!cache) {
+		/* Without -f, threads that exist already are not traced.  */
+		if (!followfork && !mmap_cache_shared_vm
+		    && has_other_threads(tgid))
+			mmap_cache_shared_vm = true;
+
+		cache = xzalloc(sizeof(*cache));
+		cache->free_fn = delete_mmap_cache;
+		cache->tgid = tgid;
+		cache->generation = ++mmap_cache_generation;
+		cache->next = mmap_caches;
+		mmap_caches = cache;
+	}
 
-	free(tcp->mmap_cache);
-	tcp->mmap_cache = NULL;
+	++cache->refcount;
+	tcp->mmap_cache = cache;
+	tcp->mmap_cache_generation = 0;
+
+	return cache;
+}
+
+static bool
+is_pseudo_path(const char *path)
+{
+	/* [heap], [stack], etc. have no file offset.  */
+	return path[0] == '[';
+}
+
+/* Returns the index of the first entry that ends after addr.  */
+static unsigned int
+find_entry_index(const struct mmap_cache_t *cache, const unsigned long addr)
+{
+	unsigned int lower = 0;
+	unsigned int upper = cache->size;
+
+	while (lower < upper) {
+		unsigned int mid = (lower + upper) / 2;
+
+		if (cache->entry[mid].end_addr <= addr)
+			lower = mid + 1;
+		else
+			upper = mid;
+	}
+	return lower;
+}
+
+static void
+insert_entry(struct mmap_cache_t *cache, const unsigned int i,
+	     const struct mmap_cache_entry_t *entry)
+{
+	if (cache->size >= cache->allocated)
+		cache->entry = xgrowarray(cache->entry, &cache->allocated,
+					  sizeof(*cache->entry));
+	memmove(&cache->entry[i + 1], &cache->entry[i],
+		(cache->size - i) * sizeof(*cache->entry));
+	cache->entry[i] = *entry;
+	cache->size++;
+}
+
+static void
+remove_entries(struct mmap_cache_t *cache, const unsigned int i,
+	       const unsigned int n)
+{
+	for (unsigned int j = i; j < i + n; ++j)
+		free(cache->entry[j].binary_filename);
+	memmove(&cache->entry[i], &cache->entry[i + n],
+		(cache->size - i - n) * sizeof(*cache->entry));
+	cache->size -= n;
+}
+
+/* Move the start of the entry to addr within it.  */
+static void
+trim_entry_start(struct mmap_cache_entry_t *entry, const unsigned long addr)
+{
+	if (!is_pseudo_path(entry->binary_filename))
+		entry->mmap_offset += addr - entry->start_addr;
+	entry->start_addr = addr;
+}
+
+/* Split the i-th entry in two at addr within it.  */
+static void
+split_entry(struct mmap_cache_t *cache, const unsigned int i,
+	    const unsigned long addr)
+{
+	struct mmap_cache_entry_t right = cache->entry[i];
+
+	right.binary_filename = xstrdup(right.binary_filename);
+	trim_entry_start(&right, addr);
+	cache->entry[i].end_addr = addr;
+	insert_entry(cache, i + 1, &right);
+}
+
+/* Split entries at the boundaries of [start, end).  */
+static void
+split_range(struct mmap_cache_t *cache, const unsigned long start,
+	    const unsigned long end)
+{
+	unsigned int i = find_entry_index(cache, start);
+
+	if (i < cache->size && cache->entry[i].start_addr < start)
+		split_entry(cache, i, start);
+
+	i = find_entry_index(cache, end);
+	if (i < cache->size && cache->entry[i].start_addr < end)
+		split_entry(cache, i, end);
+}
+
+static bool
+can_merge(const struct mmap_cache_entry_t *a,
+	  const struct mmap_cache_entry_t *b)
+{
+	return a->end_addr == b->start_addr
+	       && a->protections == b->protections
+	       && a->major == b->major
+	       && a->minor == b->minor
+	       && a->inode == b->inode
+	       && strcmp(a->binary_filename, b->binary_filename) == 0
+	       && (is_pseudo_path(a->binary_filename)
+		   || a->mmap_offset + (a->end_addr - a->start_addr)
+		      == b->mmap_offset);
+}
+
+/* Merge adjacent entries around [start, end) like the kernel does.  */
+static void
+merge_range(struct mmap_cache_t *cache, const unsigned long start,
+	    const unsigned long end)
+{
+	unsigned int i = find_entry_index(cache, start);
+
+	if (i)
+		--i;
+	while (i + 1 < cache->size && cache->entry[i].start_addr <= end) {
+		if (can_merge(&cache->entry[i], &cache->entry[i + 1])) {
+			cache->entry[i].end_addr = cache->entry[i + 1].end_addr;
+			remove_entries(cache, i + 1, 1);
+		} else {
+			++i;
+		}
+	}
+}
+
+/* Remove [start, end) from the cache.  */
+static void
+unmap_range(struct mmap_cache_t *cache, const unsigned long start,
+	    const unsigned long end)
+{
+	if (start >= end)
+		return;
+
+	split_range(cache, start, end);
+
+	const unsigned int i = find_entry_index(cache, start);
+	unsigned int j = i;
+
+	while (j < cache->size && cache->entry[j].end_addr <= end)
+		++j;
+	remove_entries(cache, i, j - i);
+}
+
+/* Map entry->binary_filename at [entry->start_addr, entry->end_addr).  */
+static void
+map_range(struct mmap_cache_t *cache, const struct mmap_cache_entry_t *entry)
+{
+	unmap_range(cache, entry->start_addr, entry->end_addr);
+	insert_entry(cache, find_entry_index(cache, entry->start_addr), entry);
+	merge_range(cache, entry->start_addr, entry->end_addr);
+}
+
+static unsigned char
+prot_to_protections(const kernel_ulong_t prot)
+{
+	return ((prot & PROT_READ) ? MMAP_CACHE_PROT_READABLE : 0)
+	       | ((prot & PROT_WRITE) ? MMAP_CACHE_PROT_WRITABLE : 0)
+	       | ((prot & PROT_EXEC) ? MMAP_CACHE_PROT_EXECUTABLE : 0);
+}
+
+static unsigned long
+page_align(const kernel_ulong_t addr)
+{
+	const unsigned long mask = get_pagesize() - 1;
+
+	return (addr + mask) & ~mask;
 }
 
 /*
- * caching of /proc/ID/maps for each process to speed up stack tracing
- *
- * The cache must be refreshed after syscalls that affect memory mappings,
- * e.g. mmap, mprotect, munmap, execve.
+ * Functions that follow syscalls return false
+ * if the effect of the syscall is not known.
  */
-extern enum mmap_cache_rebuild_result
-mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
+
+static bool
+follow_mmap(struct tcb *tcp, struct mmap_cache_t *cache,
+	    const unsigned long long offset)
+{
+	const kernel_ulong_t prot = tcp->u_arg[2];
+	const kernel_ulong_t flags = tcp->u_arg[3];
+	const int fd = tcp->u_arg[4];
+	const bool shared = (flags & MAP_TYPE) != MAP_PRIVATE;
+
+	/* A failed MAP_FIXED mapping may have unmapped the old one.  */
+	if (syserror(tcp))
+		return !(flags & MAP_FIXED);
+
+	const unsigned long start = tcp->u_rval;
+	const unsigned long end = start + page_align(tcp->u_arg[1]);
+
+	if (flags & MAP_ANONYMOUS) {
+		/* Shared and huge page anonymous mappings have names.  */
+		if (shared || (flags & MAP_HUGETLB))
+			return false;
+		unmap_range(cache, start, end);
+		return true;
+	}
+
+	char path[PATH_MAX + 1];
+	char fd_path[sizeof("/proc/%u/fd/%d") + 2 * sizeof(int)*3];
+	strace_stat_t st;
+
+	xsprintf(fd_path, "/proc/%u/fd/%d", tcp->pid, fd);
+	if (getfdpath(tcp, fd, path, sizeof(path)) < 0
+	    || stat_file(fd_path, &st))
+		return false;
+
+	const struct mmap_cache_entry_t entry = {
+		.start_addr = start,
+		.end_addr = end,
+		.mmap_offset = offset,
+		.protections = prot_to_protections(prot)
+			       | (shared ? MMAP_CACHE_PROT_SHARED : 0),
+		.major = major(st.st_dev),
+		.minor = minor(st.st_dev),
+		.inode = st.st_ino,
+		.binary_filename = xstrdup(path),
+	};
+	map_range(cache, &entry);
+
+	return true;
+}
+
+static bool
+follow_mprotect(struct tcb *tcp, struct mmap_cache_t *cache)
+{
+	const unsigned long start = tcp->u_arg[0];
+	const unsigned long end = start + page_align(tcp->u_arg[1]);
+	const kernel_ulong_t prot = tcp->u_arg[2];
+
+	/*
+	 * A failed mprotect may have changed a part of the range,
+	 * PROT_GROWSDOWN and PROT_GROWSUP extend the range.
+	 */
+	if (syserror(tcp) || (prot & (PROT_GROWSDOWN | PROT_GROWSUP)))
+		return false;
+
+	split_range(cache, start, end);
+	for (unsigned int i = find_entry_index(cache, start);
+	     i < cache->size && cache->entry[i].start_addr < end; ++i) {
+		cache->entry[i].protections =
+			prot_to_protections(prot)
+			| (cache->entry[i].protections
+			   & MMAP_CACHE_PROT_SHARED);
+	}
+	merge_range(cache, start, end);
+
+	return true;
+}
+
+static bool
+follow_mremap(struct tcb *tcp, struct mmap_cache_t *cache)
+{
+	const unsigned long old_start = tcp->u_arg[0];
+	const unsigned long old_end = old_start + page_align(tcp->u_arg[1]);
+	const unsigned long new_len = page_align(tcp->u_arg[2]);
+	const kernel_ulong_t flags = tcp->u_arg[3];
+
+	if (syserror(tcp) || old_start == old_end
+	    || (flags & MREMAP_DONTUNMAP))
+		return false;
+
+	const unsigned long new_start = tcp->u_rval;
+	const unsigned int i = find_entry_index(cache, old_start);
+
+	if (i >= cache->size || cache->entry[i].start_addr >= old_end) {
+		/* An anonymous mapping.  */
+		unmap_range(cache, new_start, new_start + new_len);
+		return true;
+	}
+
+	/* A mapping can be moved or resized only as a whole.  */
+	if (cache->entry[i].start_addr > old_start
+	    || cache->entry[i].end_addr < old_end)
+		return false;
+
+	struct mmap_cache_entry_t entry = cache->entry[i];
+
+	entry.binary_filename = xstrdup(entry.binary_filename);
+	trim_entry_start(&entry, old_start);
+	entry.start_addr = new_start;
+	entry.end_addr = new_start + new_len;
+
+	unmap_range(cache, old_start, old_end);
+	map_range(cache, &entry);
+
+	return true;
+}
+
+static bool
+follow_remap_file_pages(struct tcb *tcp, struct mmap_cache_t *cache)
+{
+	const unsigned long mask = get_pagesize() - 1;
+	const unsigned long start = tcp->u_arg[0] & ~mask;
+	const unsigned long end = start + (tcp->u_arg[1] & ~mask);
+
+	/* The emulation of remap_file_pages may fail after unmapping.  */
+	if (syserror(tcp))
+		return false;
+
+	/* The range is remapped within a single shared file mapping.  */
+	const unsigned int i = find_entry_index(cache, start);
+
+	if (i >= cache->size || cache->entry[i].start_addr > start
+	    || cache->entry[i].end_addr < end)
+		return false;
+
+	struct mmap_cache_entry_t entry = cache->entry[i];
+
+	entry.binary_filename = xstrdup(entry.binary_filename);
+	entry.start_addr = start;
+	entry.end_addr = end;
+	entry.mmap_offset = tcp->u_arg[3] * get_pagesize();
+	map_range(cache, &entry);
+
+	return true;
+}
+
+static bool
+follow_brk(struct tcb *tcp, struct mmap_cache_t *cache)
 {
-	if (tcp->mmap_cache
-	    && tcp->mmap_cache->generation != mmap_cache_generation)
-		delete_mmap_cache(tcp, caller);
+	const unsigned long new_brk = tcp->u_rval;
+	const unsigned long old_brk = cache->brk;
+
+	cache->brk = new_brk;
+
+	/* brk(0) just queries the program break.  */
+	if (!tcp->u_arg[0])
+		return !old_brk || old_brk == new_brk;
+	if (!old_brk)
+		return false;
+
+	const unsigned long old_end = page_align(old_brk);
+	const unsigned long new_end = page_align(new_brk);
+
+	if (new_end < old_end) {
+		unmap_range(cache, new_end, old_end);
+	} else if (new_end > old_end) {
+		/* The heap starts where the program break was first set.  */
+		const unsigned int i = find_entry_index(cache, old_end - 1);
+		unsigned long start = old_end;
+
+		if (i < cache->size && cache->entry[i].end_addr == old_end
+		    && strcmp(cache->entry[i].binary_filename, "[heap]") == 0)
+			start = cache->entry[i].start_addr;
+
+		const struct mmap_cache_entry_t entry = {
+			.start_addr = start,
+			.end_addr = new_end,
+			.protections = MMAP_CACHE_PROT_READABLE
+				       | MMAP_CACHE_PROT_WRITABLE,
+			.binary_filename = xstrdup("[heap]"),
+		};
+		map_range(cache, &entry);
+	}
 
+	return true;
+}
+
+static bool
+follow_syscall(struct tcb *tcp, struct mmap_cache_t *cache)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_mmap:
+		return follow_mmap(tcp, cache, tcp->u_arg[5]);
+	case SEN_mmap_pgoff:
+		return follow_mmap(tcp, cache,
+				   (unsigned long long) tcp->u_arg[5]
+				   * get_pagesize());
+	case SEN_mmap_4koff:
+		return follow_mmap(tcp, cache,
+				   (unsigned long long) tcp->u_arg[5] << 12);
+	case SEN_munmap:
+		if (!syserror(tcp))
+			unmap_range(cache, tcp->u_arg[0],
+				    tcp->u_arg[0] + page_align(tcp->u_arg[1]));
+		return true;
+	case SEN_mprotect:
+	case SEN_pkey_mprotect:
+		return follow_mprotect(tcp, cache);
+	case SEN_mremap:
+		return follow_mremap(tcp, cache);
+	case SEN_brk:
+		return follow_brk(tcp, cache);
+	case SEN_remap_file_pages:
+		return follow_remap_file_pages(tcp, cache);
+	/* These do not change mappings as shown by /proc/PID/maps.  */
+	case SEN_madvise:
+	case SEN_mlock:
+	case SEN_mlock2:
+	case SEN_mlockall:
+	case SEN_msync:
+	case SEN_munlock:
+	case SEN_munlockall:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void
+mmap_cache_update(struct tcb *tcp, const enum mmap_notify_event event,
+		  void *unused)
+{
+	if (event == MMAP_NOTIFY_EXECVE) {
+		/* The old address space is gone.  */
+		if (tcp->mmap_cache) {
+			unlink_mmap_cache(tcp->mmap_cache);
+			delete_mmap_cache(tcp, __func__);
+		}
+		return;
+	}
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_execve:
+	case SEN_execveat:
+		/* A successful execve has been reported already.  */
+		return;
+	}
+
+	struct mmap_cache_t *cache = get_mmap_cache(tcp);
+
+	if (!cache->valid)
+		return;
+
+	if (event == MMAP_NOTIFY_SYSCALL_NORESULT
+#if SUPPORTED_PERSONALITIES > 1
+	    || tcp->currpers != DEFAULT_PERSONALITY
+#endif
+	    || !follow_syscall(tcp, cache)) {
+		invalidate_mmap_cache(cache);
+	} else {
+		cache->generation = ++mmap_cache_generation;
+	}
+
+	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, valid=%d",
+		       cache->generation, mmap_cache_generation, tcp,
+		       cache->entry, cache->valid);
+}
+
+/* Re-read /proc/PID/maps before the cache is used next time.  */
+static void
+resync_mmap_cache(struct tcb *tcp)
+{
 	if (tcp->mmap_cache)
-		return MMAP_CACHE_REBUILD_READY;
+		tcp->mmap_cache->valid = false;
+}
 
+void
+mmap_cache_syscall(struct tcb *tcp)
+{
+	if (!use_mmap_cache)
+		return;
+
+	uint64_t flags;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_clone:
+	case SEN_clone3:
+		if (!fetch_clone_flags(tcp, &flags))
+			mmap_cache_shared_vm = true;
+		else if (!(flags & CLONE_VM))
+			break;
+		else if (flags & CLONE_VFORK)
+			resync_mmap_cache(tcp);
+		else if (!(flags & CLONE_THREAD) || !followfork)
+			mmap_cache_shared_vm = true;
+		break;
+	case SEN_vfork:
+		resync_mmap_cache(tcp);
+		break;
+	}
+
+	if ((seccomp_filtering && !stack_trace_enabled) || mmap_cache_shared_vm)
+		resync_mmap_cache(tcp);
+}
+
+void
+mmap_cache_enable(void)
+{
+	if (!use_mmap_cache) {
+		mmap_notify_register_client(mmap_cache_update, NULL);
+		use_mmap_cache = true;
+	}
+}
+
+static bool
+same_entries(const struct mmap_cache_t *a, const struct mmap_cache_t *b)
+{
+	if (a->size != b->size)
+		return false;
+
+	for (unsigned int i = 0; i < a->size; ++i) {
+		const struct mmap_cache_entry_t *x = &a->entry[i];
+		const struct mmap_cache_entry_t *y = &b->entry[i];
+
+		if (x->start_addr != y->start_addr
+		    || x->end_addr != y->end_addr
+		    || x->mmap_offset != y->mmap_offset
+		    || x->protections != y->protections
+		    || x->major != y->major
+		    || x->minor != y->minor
+		    || x->inode != y->inode
+		    || strcmp(x->binary_filename, y->binary_filename))
+			return false;
+	}
+
+	return true;
+}
+
+static bool
+read_mmap_cache(struct tcb *tcp, struct mmap_cache_t *cache)
+{
 	char filename[sizeof("/proc/4294967296/maps")];
 	xsprintf(filename, "/proc/%u/maps", tcp->pid);
 
 	FILE *fp = fopen_stream(filename, "r");
 	if (!fp) {
 		perror_msg("fopen: %s", filename);
-		return MMAP_CACHE_REBUILD_NOCACHE;
+		return false;
 	}
 
-	struct mmap_cache_t cache = {
-		.free_fn = delete_mmap_cache,
-		.generation = mmap_cache_generation
-	};
-
-	/* start with a small dynamically-allocated array and then expand it */
-	size_t allocated = 0;
+	struct mmap_cache_t maps = { .entry = NULL };
 	char buffer[PATH_MAX + 80];
 
 	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
@@ -107,15 +707,15 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 		char write_bit;
 		char exec_bit;
 		char shared_bit;
-		unsigned long major, minor;
+		unsigned long major, minor, inode;
 		char binary_path[sizeof(buffer)];
 
-		if (sscanf(buffer, "%lx-%lx %c%c%c%c %lx %lx:%lx %*d %[^\n]",
+		if (sscanf(buffer, "%lx-%lx %c%c%c%c %lx %lx:%lx %lu %[^\n]",
 			   &start_addr, &end_addr,
 			   &read_bit, &write_bit, &exec_bit, &shared_bit,
 			   &mmap_offset,
-			   &major, &minor,
-			   binary_path) != 10)
+			   &major, &minor, &inode,
+			   binary_path) != 11)
 			continue;
 
 		/* skip mappings that have unknown protection */
@@ -138,8 +738,8 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 		 * sanity check to make sure that we're storing
 		 * non-overlapping regions in ascending order
 		 */
-		if (cache.size > 0) {
-			entry = &cache.entry[cache.size - 1];
+		if (maps.size > 0) {
+			entry = &maps.entry[maps.size - 1];
 			if (entry->start_addr == start_addr &&
 			    entry->end_addr == end_addr) {
 				/* duplicate entry, e.g. [vsyscall] */
@@ -157,11 +757,11 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 			}
 		}
 
-		if (cache.size >= allocated)
-			cache.entry = xgrowarray(cache.entry, &allocated,
-						 sizeof(*cache.entry));
+		if (maps.size >= maps.allocated)
+			maps.entry = xgrowarray(maps.entry, &maps.allocated,
+						sizeof(*maps.entry));
 
-		entry = &cache.entry[cache.size];
+		entry = &maps.entry[maps.size];
 		entry->start_addr = start_addr;
 		entry->end_addr = end_addr;
 		entry->mmap_offset = mmap_offset;
@@ -174,21 +774,55 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 			);
 		entry->major = major;
 		entry->minor = minor;
+		entry->inode = inode;
 		entry->binary_filename = xstrdup(binary_path);
-		cache.size++;
+		entry->object = NULL;
+		maps.size++;
 	}
 	fclose(fp);
 
-	if (!cache.size)
-		return MMAP_CACHE_REBUILD_NOCACHE;
+	if (!maps.size) {
+		free(maps.entry);
+		free_entries(cache);
+		return false;
+	}
 
-	tcp->mmap_cache = xmalloc(sizeof(*tcp->mmap_cache));
-	memcpy(tcp->mmap_cache, &cache, sizeof(cache));
+	if (same_entries(cache, &maps)) {
+		/* Keep the generation, and the objects looked up.  */
+		free_entries(&maps);
+		free(maps.entry);
+	} else {
+		free_entries(cache);
+		free(cache->entry);
+		cache->entry = maps.entry;
+		cache->size = maps.size;
+		cache->allocated = maps.allocated;
+		cache->brk = 0;
+		cache->generation = ++mmap_cache_generation;
+	}
+	cache->valid = true;
 
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
-		       tcp->mmap_cache->generation, mmap_cache_generation,
-		       tcp, tcp->mmap_cache->entry, caller);
+	return true;
+}
+
+extern enum mmap_cache_rebuild_result
+mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
+{
+	struct mmap_cache_t *cache = get_mmap_cache(tcp);
+
+	if (!cache->valid) {
+		if (!read_mmap_cache(tcp, cache))
+			return MMAP_CACHE_REBUILD_NOCACHE;
+
+		debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
+			       cache->generation, mmap_cache_generation,
+			       tcp, cache->entry, caller);
+	}
+
+	if (tcp->mmap_cache_generation == cache->generation)
+		return MMAP_CACHE_REBUILD_READY;
 
+	tcp->mmap_cache_generation = cache->generation;
 	return MMAP_CACHE_REBUILD_RENEWED;
 }
 
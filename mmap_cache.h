@@ -10,13 +10,23 @@
 /*
  * Keep a sorted array of cache entries,
  * so that we can binary search through it.
+ *
+ * The cache is kept per address space and shared by all tracees
+ * that share the address space.
  */
 
 struct mmap_cache_t {
 	struct mmap_cache_entry_t *entry;
 	void (*free_fn)(struct tcb *, const char *caller);
 	unsigned int size;
-	unsigned int generation;
+	unsigned int generation;	/* Changed on every update */
+
+	size_t allocated;
+	unsigned int refcount;
+	int tgid;			/* Process owning the address space */
+	unsigned long brk;		/* Program break, 0 if unknown */
+	bool valid;			/* Whether entries are up to date */
+	struct mmap_cache_t *next;
 };
 
 struct mmap_cache_entry_t {
@@ -30,6 +40,7 @@ struct mmap_cache_entry_t {
 	 * protections is MMAP_CACHE_PROT_READABLE|MMAP_CACHE_PROT_EXECUTABLE
 	 * major       is 0xfc
 	 * minor       is 0x00
+	 * inode       is 1180246
 	 * binary_filename is "/lib/libc-2.11.1.so"
 	 */
 	unsigned long start_addr;
@@ -37,7 +48,10 @@ struct mmap_cache_entry_t {
 	unsigned long mmap_offset;
 	unsigned char protections;
 	unsigned long major, minor;
+	unsigned long inode;
 	char *binary_filename;
+	/* Object file in the symbol cache, looked up by the unwinder. */
+	struct unwind_object *object;
 };
 
 enum mmap_cache_protection {
@@ -58,6 +72,10 @@ typedef bool (*mmap_cache_search_fn)(struct mmap_cache_entry_t *, void *);
 extern void
 mmap_cache_enable(void);
 
+/* Called at exit of every syscall stopped at.  */
+extern void
+mmap_cache_syscall(struct tcb *);
+
 extern enum mmap_cache_rebuild_result
 mmap_cache_rebuild_if_invalid(struct tcb *, const char *caller);
 
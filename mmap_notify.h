@@ -9,12 +9,30 @@
 
 # include "defs.h"
 
-typedef void (*mmap_notify_fn)(struct tcb *, void *);
+enum mmap_notify_event {
+	/*
+	 * A syscall that may change memory mappings has exited,
+	 * its result is in tcp->u_rval and tcp->u_error.
+	 */
+	MMAP_NOTIFY_SYSCALL,
+	/* Likewise, but the result of the syscall is not known.  */
+	MMAP_NOTIFY_SYSCALL_NORESULT,
+	/*
+	 * The tracee has replaced its address space by execve,
+	 * it is not necessarily inside a syscall.
+	 */
+	MMAP_NOTIFY_EXECVE,
+};
+
+typedef void (*mmap_notify_fn)(struct tcb *, enum mmap_notify_event, void *);
 
 extern void
 mmap_notify_register_client(mmap_notify_fn, void *);
 
+extern bool
+mmap_notify_has_clients(void);
+
 extern void
-mmap_notify_report (struct tcb *);
+mmap_notify_report(struct tcb *, enum mmap_notify_event);
 
 #endif /* !STRACE_MMAP_NOTIFY_H */
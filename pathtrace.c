@@ -11,6 +11,7 @@
 #include <limits.h>
 #include <poll.h>
 
+#include "fd_cache.h"
 #include "number_set.h"
 #include "syscall.h"
 #include "xstring.h"
@@ -75,18 +76,12 @@ storepath(const char *path, struct path_set *set)
 	set->paths_selected[set->num_selected++] = path;
 }
 
-/*
- * Get path associated with fd.
- */
-int
-getfdpath(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
+static int
+readfdlink(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
 {
 	char linkpath[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int)*3];
 	ssize_t n;
 
-	if (fd < 0)
-		return -1;
-
 	xsprintf(linkpath, "/proc/%u/fd/%u", tcp->pid, fd);
 	n = readlink(linkpath, buf, bufsize - 1);
 	/*
@@ -98,6 +93,38 @@ getfdpath(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
 	return n;
 }
 
+/*
+ * Get path associated with fd.
+ */
+int
+getfdpath(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
+{
+	int n;
+
+	if (fd < 0)
+		return -1;
+
+	n = fd_cache_lookup(tcp, fd, buf, bufsize);
+	if (n >= 0) {
+		if (!debug_flag)
+			return n;
+
+		/* Verify the cached path.  */
+		char path[PATH_MAX + 1];
+		int m = readfdlink(tcp, fd, path, sizeof(path));
+
+		if (m >= 0 && !strncmp(buf, path, bufsize - 1))
+			return n;
+		error_msg("pid %d: fd %d: cached path \"%s\" does not match"
+			  " \"%s\"", tcp->pid, fd, buf, m >= 0 ? path : "");
+	}
+
+	n = readfdlink(tcp, fd, buf, bufsize);
+	if (n >= 0 && (unsigned) n < bufsize - 1)
+		fd_cache_store(tcp, fd, buf, n);
+	return n;
+}
+
 /*
  * Add a path to the set we're tracing.  Also add the canonicalized
  * version of the path.  Specifying NULL will delete all paths.
@@ -2,6 +2,7 @@
 # define STRACE_PRINT_UTILS_H
 
 # include <inttypes.h>
+# include <string.h>
 
 /* Hexadecimal output utils */
 
@@ -28,6 +29,63 @@ sprint_byte_hex(char *buf, uint8_t val)
 	return buf;
 }
 
+/* Integer output utils */
+
+/**
+ * Print the decimal representation of val to buf, without a terminating
+ * null byte; buf must have room for 20 characters.
+ *
+ * @return Pointer past the last character printed.
+ */
+static inline char *
+sprint_uint64_dec(char *buf, uint64_t val)
+{
+	char tmp[20];
+	char *p = tmp + sizeof(tmp);
+
+	do {
+		*--p = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	const size_t len = tmp + sizeof(tmp) - p;
+	memcpy(buf, p, len);
+
+	return buf + len;
+}
+
+/**
+ * Print val to buf the way %#llx does, that is, 0 as is and other values
+ * in hexadecimal with the 0x prefix, without a terminating null byte;
+ * buf must have room for 18 characters.
+ *
+ * @return Pointer past the last character printed.
+ */
+static inline char *
+sprint_uint64_hex(char *buf, uint64_t val)
+{
+	char tmp[16];
+	char *p = tmp + sizeof(tmp);
+
+	if (!val) {
+		*buf++ = '0';
+		return buf;
+	}
+
+	do {
+		*--p = hex_chars[val & 0xf];
+		val >>= 4;
+	} while (val);
+
+	*buf++ = '0';
+	*buf++ = 'x';
+
+	const size_t len = tmp + sizeof(tmp) - p;
+	memcpy(buf, p, len);
+
+	return buf + len;
+}
+
 /* Character classification utils */
 
 static inline bool
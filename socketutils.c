@@ -8,6 +8,9 @@
  */
 
 #include "defs.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -24,37 +27,169 @@
 # define UNIX_PATH_MAX sizeof_field(struct sockaddr_un, sun_path)
 #endif
 
+#include "index_table.h"
+#include "largefile_wrappers.h"
+#include "syscall.h"
 #include "xstring.h"
 
 #define XLAT_MACROS_ONLY
 #include "xlat/inet_protocols.h"
+#include "xlat/tcp_states.h"
 #undef XLAT_MACROS_ONLY
 
+/*
+ * Details of sockets are cached in an array indexed by socket inode.
+ * On a cache miss, all sockets of the protocol are dumped with a single
+ * sock_diag request and added to the cache, so that a tracee with many
+ * sockets does not cost a netlink round trip per socket.
+ * sock_diag sockets are kept open, one for every network namespace
+ * of tracees.
+ *
+ * Every sock_diag request has its own generation number.  An entry
+ * is dead when a later dump of its protocol in its network namespace
+ * does not contain it, that is, the socket has been closed.
+ * Dead entries are never used and are purged when the cache fills up.
+ *
+ * Some details are known to be transient, e.g. a connected unix socket
+ * gets its peer only when the connection is accepted, and the details
+ * of a socket change when a tracee binds or connects it.  Such entries
+ * are returned by the request that has found them, but never reused.
+ *
+ * Unix sockets can also be queried one by one.  A unix socket that
+ * is not in a recent dump, or whose entry is transient, is queried
+ * directly, so that a tracee creating sockets one after another does not
+ * cost a dump per socket.
+ */
+
 typedef struct {
 	unsigned long inode;
 	char *details;
+	/* Generation of the request that has found the socket. */
+	unsigned int generation;
+	/* Generation of the last dump of the protocol of the socket. */
+	const unsigned int *last_dump;
+	bool transient;
 } cache_entry;
 
-#define CACHE_SIZE 1024U
-static cache_entry cache[CACHE_SIZE];
-#define CACHE_MASK (CACHE_SIZE - 1)
+/* The minimum number of entries at which the cache is purged. */
+#define CACHE_MIN_PURGE 512U
+static cache_entry *cache;
+static size_t cache_size;
+static size_t cache_used;
+/* The number of entries at which the cache is purged next. */
+static size_t cache_purge_at = CACHE_MIN_PURGE;
+static struct index_table cache_index;
+
+/* Generation of the last sock_diag request. */
+static unsigned int generation;
+/*
+ * The number of requests after a dump of unix sockets
+ * during which sockets missing from it are queried directly.
+ */
+#define UNIX_DUMP_MAX_AGE 64U
+
+/* What the response parsers need to know about the request. */
+struct sock_dump {
+	const char *proto_name;
+	const unsigned int *last_dump;
+	unsigned int generation;
+	/* The inode of the socket queried, 0 for dumps. */
+	unsigned long inode;
+};
+
+static bool
+cache_entry_is_valid(const cache_entry *const e)
+{
+	return !e->transient && e->generation >= *e->last_dump;
+}
+
+static uint32_t
+cache_hash(const unsigned long inode)
+{
+	return hash_bytes(HASH_INIT, &inode, sizeof(inode));
+}
+
+static bool
+cache_entry_matches(const unsigned int num, const void *inode)
+{
+	return cache[num].inode == *(const unsigned long *) inode;
+}
+
+/* Returns the entry of the given inode, or NULL if there is none. */
+static cache_entry *
+cache_find(const unsigned long inode)
+{
+	const unsigned int num = index_table_lookup(&cache_index,
+						    cache_hash(inode),
+						    cache_entry_matches,
+						    &inode);
+
+	return num != INDEX_TABLE_NONE ? &cache[num] : NULL;
+}
+
+/* Remove dead and transient entries from the cache. */
+static void
+cache_purge(void)
+{
+	size_t n = 0;
+
+	index_table_clear(&cache_index);
+	for (size_t i = 0; i < cache_used; ++i) {
+		if (cache_entry_is_valid(&cache[i])) {
+			cache[n] = cache[i];
+			index_table_add(&cache_index,
+					cache_hash(cache[n].inode), n);
+			++n;
+		} else {
+			free(cache[i].details);
+		}
+	}
+
+	cache_used = n;
+	cache_purge_at = MAX(CACHE_MIN_PURGE, n * 2);
+}
 
+/*
+ * Returns 1 if the details are of the socket queried,
+ * telling the caller that there is nothing more to receive.
+ */
 static int
-cache_inode_details(const unsigned long inode, char *const details)
+cache_inode_details(const struct sock_dump *const dump,
+		    const unsigned long inode, char *const details,
+		    const bool transient)
 {
-	cache_entry *e = &cache[inode & CACHE_MASK];
-	free(e->details);
+	/* Sockets without inode, e.g. in TIME_WAIT state, are of no use.  */
+	if (!inode) {
+		free(details);
+		return 0;
+	}
+
+	cache_entry *e = cache_find(inode);
+
+	if (e) {
+		free(e->details);
+	} else {
+		if (cache_used >= cache_purge_at)
+			cache_purge();
+		if (cache_used >= cache_size)
+			cache = xgrowarray(cache, &cache_size, sizeof(*cache));
+		e = &cache[cache_used];
+		index_table_add(&cache_index, cache_hash(inode), cache_used++);
+	}
 	e->inode = inode;
 	e->details = details;
+	e->generation = dump->generation;
+	e->last_dump = dump->last_dump;
+	e->transient = transient;
 
-	return 1;
+	return inode == dump->inode;
 }
 
 static const char *
 get_sockaddr_by_inode_cached(const unsigned long inode)
 {
-	const cache_entry *const e = &cache[inode & CACHE_MASK];
-	return (e && inode == e->inode) ? e->details : NULL;
+	const cache_entry *const e = cache_find(inode);
+	return (e && cache_entry_is_valid(e)) ? e->details : NULL;
 }
 
 static bool
@@ -68,6 +203,25 @@ print_sockaddr_by_inode_cached(const unsigned long inode)
 	return false;
 }
 
+void
+sockaddr_cache_syscall(struct tcb *const tcp)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_bind:
+	case SEN_connect: {
+		if (!cache_used)
+			break;
+
+		const unsigned long inode = getfdinode(tcp, tcp->u_arg[0]);
+		cache_entry *const e = inode ? cache_find(inode) : NULL;
+
+		if (e)
+			e->transient = true;
+		break;
+	}
+	}
+}
+
 static bool
 send_query(struct tcb *tcp, const int fd, void *req, size_t req_size)
 {
@@ -97,7 +251,7 @@ send_query(struct tcb *tcp, const int fd, void *req, size_t req_size)
 
 static bool
 inet_send_query(struct tcb *tcp, const int fd, const int family,
-		const int proto)
+		const int proto, const uint32_t seq)
 {
 	struct {
 		const struct nlmsghdr nlh;
@@ -106,7 +260,8 @@ inet_send_query(struct tcb *tcp, const int fd, const int family,
 		.nlh = {
 			.nlmsg_len = sizeof(req),
 			.nlmsg_type = SOCK_DIAG_BY_FAMILY,
-			.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST
+			.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+			.nlmsg_seq = seq
 		},
 		.idr = {
 			.sdiag_family = family,
@@ -119,17 +274,16 @@ inet_send_query(struct tcb *tcp, const int fd, const int family,
 
 static int
 inet_parse_response(const void *const data, const int data_len,
-		    const unsigned long inode, void *opaque_data)
+		    void *opaque_data)
 {
-	const char *const proto_name = opaque_data;
+	const struct sock_dump *const dump = opaque_data;
+	const char *const proto_name = dump->proto_name;
 	const struct inet_diag_msg *const diag_msg = data;
 	static const char zero_addr[sizeof(struct in6_addr)];
 	socklen_t addr_size, text_size;
 
 	if (data_len < (int) NLMSG_LENGTH(sizeof(*diag_msg)))
 		return -1;
-	if (diag_msg->idiag_inode != inode)
-		return 0;
 
 	switch (diag_msg->idiag_family) {
 		case AF_INET:
@@ -167,22 +321,27 @@ inet_parse_response(const void *const data, const int data_len,
 			     ob, src_buf, cb, ntohs(diag_msg->id.idiag_sport),
 			     ob, dst_buf, cb, ntohs(diag_msg->id.idiag_dport))
 		    < 0)
-			return false;
+			return -1;
 	} else {
 		if (asprintf(&details, "%s:[%s%s%s:%u]",
 			     proto_name, ob, src_buf, cb,
 			     ntohs(diag_msg->id.idiag_sport)) < 0)
-			return false;
+			return -1;
 	}
 
-	return cache_inode_details(inode, details);
+	return cache_inode_details(dump, diag_msg->idiag_inode, details,
+				   false);
 }
 
+/*
+ * Receive the responses to the request with the given sequence number
+ * until the end of the dump, or until the parser returns a positive value.
+ * The responses to earlier requests that have not been received are skipped.
+ */
 static bool
-receive_responses(struct tcb *tcp, const int fd, const unsigned long inode,
+receive_responses(struct tcb *tcp, const int fd, const uint32_t seq,
 		  const unsigned long expected_msg_type,
-		  int (*parser)(const void *, int,
-				unsigned long, void *),
+		  int (*parser)(const void *, int, void *),
 		  void *opaque_data)
 {
 	static union {
@@ -218,10 +377,14 @@ receive_responses(struct tcb *tcp, const int fd, const unsigned long inode,
 		if (!is_nlmsg_ok(h, ret))
 			return false;
 		for (; is_nlmsg_ok(h, ret); h = NLMSG_NEXT(h, ret)) {
+			if (h->nlmsg_seq != seq)
+				continue;
+			if (h->nlmsg_type == NLMSG_DONE)
+				return true;
 			if (h->nlmsg_type != expected_msg_type)
 				return false;
 			const int rc = parser(NLMSG_DATA(h),
-					      h->nlmsg_len, inode, opaque_data);
+					      h->nlmsg_len, opaque_data);
 			if (rc > 0)
 				return true;
 			if (rc < 0)
@@ -231,16 +394,11 @@ receive_responses(struct tcb *tcp, const int fd, const unsigned long inode,
 	}
 }
 
+/* Query the unix socket with the given inode, or dump all if it is 0. */
 static bool
-unix_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
+unix_send_query(struct tcb *tcp, const int fd, const unsigned long inode,
+		const uint32_t seq)
 {
-	/*
-	 * The kernel bug was fixed in mainline by commit v4.5-rc6~35^2~11
-	 * and backported to stable/linux-4.4.y by commit v4.4.4~297.
-	 */
-	const uint16_t dump_flag =
-		os_release < KERNEL_VERSION(4, 4, 4) ? NLM_F_DUMP : 0;
-
 	struct {
 		const struct nlmsghdr nlh;
 		const struct unix_diag_req udr;
@@ -248,7 +406,8 @@ unix_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
 		.nlh = {
 			.nlmsg_len = sizeof(req),
 			.nlmsg_type = SOCK_DIAG_BY_FAMILY,
-			.nlmsg_flags = NLM_F_REQUEST | dump_flag
+			.nlmsg_flags = NLM_F_REQUEST | (inode ? 0 : NLM_F_DUMP),
+			.nlmsg_seq = seq
 		},
 		.udr = {
 			.sdiag_family = AF_UNIX,
@@ -262,21 +421,20 @@ unix_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
 }
 
 static int
-unix_parse_response(const void *data, const int data_len,
-		    const unsigned long inode, void *opaque_data)
+unix_parse_response(const void *data, const int data_len, void *opaque_data)
 {
-	const char *proto_name = opaque_data;
+	const struct sock_dump *const dump = opaque_data;
+	const char *proto_name = dump->proto_name;
 	const struct unix_diag_msg *diag_msg = data;
 	struct rtattr *attr;
 	int rta_len = data_len - NLMSG_LENGTH(sizeof(*diag_msg));
+	const unsigned long inode = diag_msg->udiag_ino;
 	uint32_t peer = 0;
 	size_t path_len = 0;
 	char path[UNIX_PATH_MAX + 1];
 
 	if (rta_len < 0)
 		return -1;
-	if (diag_msg->udiag_ino != inode)
-		return 0;
 	if (diag_msg->udiag_family != AF_UNIX)
 		return -1;
 
@@ -305,7 +463,7 @@ unix_parse_response(const void *data, const int data_len,
 	 * "UNIX:[" SELF_INODE [ "->" PEER_INODE ][ "," SOCKET_FILE ] "]"
 	 */
 	if (!peer && !path_len)
-		return -1;
+		return dump->inode && inode == dump->inode;
 
 	char peer_str[3 + sizeof(peer) * 3];
 	if (peer)
@@ -336,11 +494,13 @@ unix_parse_response(const void *data, const int data_len,
 		     peer_str, path_str) < 0)
 		return -1;
 
-	return cache_inode_details(inode, details);
+	return cache_inode_details(dump, inode, details,
+				   diag_msg->udiag_state == TCP_ESTABLISHED
+				   && !peer);
 }
 
 static bool
-netlink_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
+netlink_send_query(struct tcb *tcp, const int fd, const uint32_t seq)
 {
 	struct {
 		const struct nlmsghdr nlh;
@@ -349,7 +509,8 @@ netlink_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
 		.nlh = {
 			.nlmsg_len = sizeof(req),
 			.nlmsg_type = SOCK_DIAG_BY_FAMILY,
-			.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST
+			.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+			.nlmsg_seq = seq
 		},
 		.ndr = {
 			.sdiag_family = AF_NETLINK,
@@ -361,17 +522,16 @@ netlink_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
 
 static int
 netlink_parse_response(const void *data, const int data_len,
-		       const unsigned long inode, void *opaque_data)
+		       void *opaque_data)
 {
-	const char *proto_name = opaque_data;
+	const struct sock_dump *const dump = opaque_data;
+	const char *proto_name = dump->proto_name;
 	const struct netlink_diag_msg *const diag_msg = data;
 	const char *netlink_proto;
 	char *details;
 
 	if (data_len < (int) NLMSG_LENGTH(sizeof(*diag_msg)))
 		return -1;
-	if (diag_msg->ndiag_ino != inode)
-		return 0;
 
 	if (diag_msg->ndiag_family != AF_NETLINK)
 		return -1;
@@ -390,87 +550,86 @@ netlink_parse_response(const void *data, const int data_len,
 			return -1;
 	}
 
-	return cache_inode_details(inode, details);
+	return cache_inode_details(dump, diag_msg->ndiag_ino, details,
+				   false);
 }
 
-static const char *
-unix_get(struct tcb *tcp, const int fd, const int family, const int proto,
-	 const unsigned long inode, const char *name)
+static bool
+unix_dump(struct tcb *tcp, const int fd, const int family, const int proto,
+	  const struct sock_dump *const dump)
 {
-	return unix_send_query(tcp, fd, inode)
-		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
-				     unix_parse_response, (void *) name)
-		? get_sockaddr_by_inode_cached(inode) : NULL;
+	return unix_send_query(tcp, fd, dump->inode, dump->generation)
+		&& receive_responses(tcp, fd, dump->generation,
+				     SOCK_DIAG_BY_FAMILY, unix_parse_response,
+				     (void *) dump);
 }
 
-static const char *
-inet_get(struct tcb *tcp, const int fd, const int family, const int protocol,
-	 const unsigned long inode, const char *proto_name)
+static bool
+inet_dump(struct tcb *tcp, const int fd, const int family, const int proto,
+	  const struct sock_dump *const dump)
 {
-	return inet_send_query(tcp, fd, family, protocol)
-		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
-				     inet_parse_response, (void *) proto_name)
-		? get_sockaddr_by_inode_cached(inode) : NULL;
+	return inet_send_query(tcp, fd, family, proto, dump->generation)
+		&& receive_responses(tcp, fd, dump->generation,
+				     SOCK_DIAG_BY_FAMILY, inet_parse_response,
+				     (void *) dump);
 }
 
-static const char *
-netlink_get(struct tcb *tcp, const int fd, const int family, const int protocol,
-	    const unsigned long inode, const char *proto_name)
+static bool
+netlink_dump(struct tcb *tcp, const int fd, const int family, const int proto,
+	     const struct sock_dump *const dump)
 {
-	return netlink_send_query(tcp, fd, inode)
-		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
-				     netlink_parse_response,
-				     (void *) proto_name)
-		? get_sockaddr_by_inode_cached(inode) : NULL;
+	return netlink_send_query(tcp, fd, dump->generation)
+		&& receive_responses(tcp, fd, dump->generation,
+				     SOCK_DIAG_BY_FAMILY,
+				     netlink_parse_response, (void *) dump);
 }
 
 static const struct {
 	const char *const name;
-	const char * (*const get)(struct tcb *, int fd, int family,
-				  int protocol, unsigned long inode,
-				  const char *proto_name);
+	bool (*const dump)(struct tcb *, int fd, int family, int protocol,
+			   const struct sock_dump *);
 	int family;
 	int proto;
 } protocols[] = {
-	[SOCK_PROTO_UNIX]	= { "UNIX",	unix_get,	AF_UNIX},
+	[SOCK_PROTO_UNIX]	= { "UNIX",	unix_dump,	AF_UNIX},
 	/*
 	 * inet_diag handlers are currently implemented only for TCP,
 	 * UDP(lite), SCTP, RAW, and DCCP, but we try to resolve it for all
 	 * protocols anyway, just in case.
 	 */
 	[SOCK_PROTO_TCP]	=
-		{ "TCP",	inet_get, AF_INET,  IPPROTO_TCP },
+		{ "TCP",	inet_dump, AF_INET,  IPPROTO_TCP },
 	[SOCK_PROTO_UDP]	=
-		{ "UDP",	inet_get, AF_INET,  IPPROTO_UDP },
+		{ "UDP",	inet_dump, AF_INET,  IPPROTO_UDP },
 	[SOCK_PROTO_UDPLITE]	=
-		{ "UDPLITE",	inet_get, AF_INET,  IPPROTO_UDPLITE },
+		{ "UDPLITE",	inet_dump, AF_INET,  IPPROTO_UDPLITE },
 	[SOCK_PROTO_DCCP]	=
-		{ "DCCP",	inet_get, AF_INET,  IPPROTO_DCCP },
+		{ "DCCP",	inet_dump, AF_INET,  IPPROTO_DCCP },
 	[SOCK_PROTO_SCTP]	=
-		{ "SCTP",	inet_get, AF_INET,  IPPROTO_SCTP },
+		{ "SCTP",	inet_dump, AF_INET,  IPPROTO_SCTP },
 	[SOCK_PROTO_L2TP_IP]	=
-		{ "L2TP/IP",	inet_get, AF_INET,  IPPROTO_L2TP },
+		{ "L2TP/IP",	inet_dump, AF_INET,  IPPROTO_L2TP },
 	[SOCK_PROTO_PING]	=
-		{ "PING",	inet_get, AF_INET,  IPPROTO_ICMP },
+		{ "PING",	inet_dump, AF_INET,  IPPROTO_ICMP },
 	[SOCK_PROTO_RAW]	=
-		{ "RAW",	inet_get, AF_INET,  IPPROTO_RAW },
+		{ "RAW",	inet_dump, AF_INET,  IPPROTO_RAW },
 	[SOCK_PROTO_TCPv6]	=
-		{ "TCPv6",	inet_get, AF_INET6, IPPROTO_TCP },
+		{ "TCPv6",	inet_dump, AF_INET6, IPPROTO_TCP },
 	[SOCK_PROTO_UDPv6]	=
-		{ "UDPv6",	inet_get, AF_INET6, IPPROTO_UDP },
+		{ "UDPv6",	inet_dump, AF_INET6, IPPROTO_UDP },
 	[SOCK_PROTO_UDPLITEv6]	=
-		{ "UDPLITEv6",	inet_get, AF_INET6, IPPROTO_UDPLITE },
+		{ "UDPLITEv6",	inet_dump, AF_INET6, IPPROTO_UDPLITE },
 	[SOCK_PROTO_DCCPv6]	=
-		{ "DCCPv6",	inet_get, AF_INET6, IPPROTO_DCCP },
+		{ "DCCPv6",	inet_dump, AF_INET6, IPPROTO_DCCP },
 	[SOCK_PROTO_SCTPv6]	=
-		{ "SCTPv6",	inet_get, AF_INET6, IPPROTO_SCTP },
+		{ "SCTPv6",	inet_dump, AF_INET6, IPPROTO_SCTP },
 	[SOCK_PROTO_L2TP_IPv6]	=
-		{ "L2TP/IPv6",	inet_get, AF_INET6, IPPROTO_L2TP },
+		{ "L2TP/IPv6",	inet_dump, AF_INET6, IPPROTO_L2TP },
 	[SOCK_PROTO_PINGv6]	=
-		{ "PINGv6",	inet_get, AF_INET6, IPPROTO_ICMP },
+		{ "PINGv6",	inet_dump, AF_INET6, IPPROTO_ICMP },
 	[SOCK_PROTO_RAWv6]	=
-		{ "RAWv6",	inet_get, AF_INET6, IPPROTO_RAW },
-	[SOCK_PROTO_NETLINK]	= { "NETLINK",	netlink_get,	AF_NETLINK },
+		{ "RAWv6",	inet_dump, AF_INET6, IPPROTO_RAW },
+	[SOCK_PROTO_NETLINK]	= { "NETLINK",	netlink_dump,	AF_NETLINK },
 };
 
 enum sock_proto
@@ -494,40 +653,169 @@ get_family_by_proto(enum sock_proto proto)
 	return AF_UNSPEC;
 }
 
+/* A sock_diag socket in a network namespace. */
+struct diag_socket {
+	unsigned long netns;	/* Inode of the network namespace. */
+	int fd;
+	/* Generations of the last dumps of protocols. */
+	unsigned int last_dump[ARRAY_SIZE(protocols)];
+};
+
+static struct diag_socket **diag_sockets;
+static size_t diag_sockets_size;
+static size_t diag_sockets_count;
+
+static unsigned long
+get_netns(const int pid)
+{
+	char path[sizeof("/proc/%u/ns/net") + sizeof(int)*3];
+	strace_stat_t st;
+
+	xsprintf(path, "/proc/%u/ns/net", pid);
+	return stat_file(path, &st) ? 0 : st.st_ino;
+}
+
+static int
+open_diag_socket(struct tcb *tcp, const unsigned long netns)
+{
+	static unsigned long own_netns;
+
+	if (!own_netns)
+		own_netns = get_netns(getpid());
+
+	if (netns == own_netns)
+		return socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+			      NETLINK_SOCK_DIAG);
+
+	/*
+	 * The socket has to be created in the network namespace
+	 * of the tracee to see its sockets.
+	 */
+	int fd = -1;
+#ifdef HAVE_SETNS
+	char path[sizeof("/proc/%u/ns/net") + sizeof(int)*3];
+
+	xsprintf(path, "/proc/%u/ns/net", tcp->pid);
+	const int own_fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+	const int ns_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (own_fd >= 0 && ns_fd >= 0 && !setns(ns_fd, CLONE_NEWNET)) {
+		fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+			    NETLINK_SOCK_DIAG);
+		if (setns(own_fd, CLONE_NEWNET))
+			perror_func_msg_and_die("setns");
+	}
+	if (ns_fd >= 0)
+		close(ns_fd);
+	if (own_fd >= 0)
+		close(own_fd);
+#endif
+	return fd;
+}
+
+static struct diag_socket *
+get_diag_socket(struct tcb *tcp)
+{
+	const unsigned long netns = get_netns(tcp->pid);
+	struct diag_socket *d = NULL;
+	size_t i;
+
+	for (i = 0; i < diag_sockets_count; ++i) {
+		if (diag_sockets[i]->netns == netns) {
+			d = diag_sockets[i];
+			break;
+		}
+	}
+
+	if (!d) {
+		if (diag_sockets_count >= diag_sockets_size)
+			diag_sockets = xgrowarray(diag_sockets,
+						  &diag_sockets_size,
+						  sizeof(*diag_sockets));
+		d = xzalloc(sizeof(*d));
+		d->netns = netns;
+		d->fd = -1;
+		diag_sockets[diag_sockets_count++] = d;
+	}
+
+	if (d->fd < 0)
+		d->fd = open_diag_socket(tcp, netns);
+
+	return d->fd < 0 ? NULL : d;
+}
+
+static const char *
+get_sockaddr_by_inode_proto(struct tcb *tcp, struct diag_socket *const d,
+			    const unsigned long inode, const unsigned int proto)
+{
+	struct sock_dump dump = {
+		.proto_name = protocols[proto].name,
+		.last_dump = &d->last_dump[proto],
+		.generation = ++generation,
+	};
+	bool rc;
+
+	/*
+	 * A unix socket that is not in a recent dump has most likely been
+	 * created after the dump, it is cheaper to query it directly.
+	 * The kernel bug that prevented that was fixed in mainline
+	 * by commit v4.5-rc6~35^2~11 and backported to stable/linux-4.4.y
+	 * by commit v4.4.4~297.
+	 */
+	if (proto == SOCK_PROTO_UNIX && os_release >= KERNEL_VERSION(4, 4, 4)
+	    && (cache_find(inode) || (d->last_dump[proto]
+				      && dump.generation - d->last_dump[proto]
+					 <= UNIX_DUMP_MAX_AGE)))
+		dump.inode = inode;
+
+	rc = protocols[proto].dump(tcp, d->fd, protocols[proto].family,
+				   protocols[proto].proto, &dump);
+	if (!rc) {
+		/* Do not leave a half-read response behind.  */
+		close(d->fd);
+		d->fd = -1;
+		return NULL;
+	}
+	if (!dump.inode)
+		d->last_dump[proto] = dump.generation;
+
+	const cache_entry *const e = cache_find(inode);
+	if (!e)
+		return NULL;
+	if (e->transient)
+		return e->generation == dump.generation ? e->details : NULL;
+	return cache_entry_is_valid(e) ? e->details : NULL;
+}
+
 static const char *
 get_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
 			       const enum sock_proto proto)
 {
 	if ((unsigned int) proto >= ARRAY_SIZE(protocols) ||
-	    (proto != SOCK_PROTO_UNKNOWN && !protocols[proto].get))
+	    (proto != SOCK_PROTO_UNKNOWN && !protocols[proto].dump))
 		return NULL;
 
-	const int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
-	if (fd < 0)
+	struct diag_socket *const d = get_diag_socket(tcp);
+	if (!d)
 		return NULL;
-	const char *details = NULL;
 
-	if (proto != SOCK_PROTO_UNKNOWN) {
-		details = protocols[proto].get(tcp, fd, protocols[proto].family,
-					       protocols[proto].proto, inode,
-					       protocols[proto].name);
-	} else {
-		unsigned int i;
-		for (i = (unsigned int) SOCK_PROTO_UNKNOWN + 1;
-		     i < ARRAY_SIZE(protocols); ++i) {
-			if (!protocols[i].get)
-				continue;
-			details = protocols[i].get(tcp, fd,
-						   protocols[proto].family,
-						   protocols[proto].proto,
-						   inode,
-						   protocols[proto].name);
-			if (details)
-				break;
-		}
+	if (proto != SOCK_PROTO_UNKNOWN)
+		return get_sockaddr_by_inode_proto(tcp, d, inode, proto);
+
+	const char *details = NULL;
+	unsigned int i;
+	for (i = (unsigned int) SOCK_PROTO_UNKNOWN + 1;
+	     i < ARRAY_SIZE(protocols); ++i) {
+		if (!protocols[i].dump)
+			continue;
+		/* The socket is closed if the previous protocol failed.  */
+		if (d->fd < 0 && (d->fd = open_diag_socket(tcp, d->netns)) < 0)
+			break;
+		details = get_sockaddr_by_inode_proto(tcp, d, inode, i);
+		if (details)
+			break;
 	}
 
-	close(fd);
 	return details;
 }
 
@@ -601,8 +889,7 @@ genl_send_dump_families(struct tcb *tcp, const int fd)
 
 static int
 genl_parse_families_response(const void *const data,
-			     const int data_len, const unsigned long inode,
-			     void *opaque_data)
+			     const int data_len, void *opaque_data)
 {
 	struct dyxlat *const dyxlat = opaque_data;
 	const struct genlmsghdr *const gnlh = data;
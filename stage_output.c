@@ -7,69 +7,69 @@
  */
 
 /*
- * open_memstream returns a FILE stream that allows writing to a
- * dynamically growing buffer, that can be either copied to
- * tcp->outf (syscall successful) or dropped (syscall failed)
+ * The output of a syscall is staged in tcp->outbuf until its status
+ * is known, and then either let out to tcp->outf (the status is wanted)
+ * or dropped (the status is not wanted).  The buffer is reused from one
+ * syscall to another, so staging allocates nothing in the common case.
+ *
+ * With --latency-threshold, the output is also staged until the syscall
+ * completes, and is dropped if the syscall has not taken long enough.
  */
 
 #include "defs.h"
+#include "number_set.h"
 
-struct staged_output_data {
-	char *memfptr;
-	size_t memfloc;
-	FILE *real_outf;	/* Backup for real outf while staging */
-};
-
-FILE *
-strace_open_memstream(struct tcb *tcp)
+void
+strace_open_staged_output(struct tcb *tcp)
 {
-	FILE *fp = NULL;
-
-#if HAVE_OPEN_MEMSTREAM
-	tcp->staged_output_data = xmalloc(sizeof(*tcp->staged_output_data));
-	fp = open_memstream(&tcp->staged_output_data->memfptr,
-			    &tcp->staged_output_data->memfloc);
-	if (!fp)
-		perror_msg_and_die("open_memstream");
 	/*
-	 * Call to fflush required to update tcp->memfptr,
-	 * see open_memstream man page.
+	 * The output printed so far is not staged, make sure
+	 * it is not held back along with the staged output.
 	 */
-	fflush(fp);
+	flush_tcp_output(tcp);
 
-	/* Store the FILE pointer for later restoration. */
-	tcp->staged_output_data->real_outf = tcp->outf;
-	tcp->outf = fp;
-#endif
-
-	return fp;
+	tcp->flags |= TCB_STAGED_OUTPUT;
 }
 
 void
-strace_close_memstream(struct tcb *tcp, bool publish)
+strace_close_staged_output(struct tcb *tcp, bool publish)
 {
-#if HAVE_OPEN_MEMSTREAM
-	if (!tcp->staged_output_data) {
-		debug_msg("memstream already closed");
+	if (!(tcp->flags & TCB_STAGED_OUTPUT)) {
+		debug_msg("staged output already closed");
 		return;
 	}
 
-	if (fclose(tcp->outf))
-		perror_msg("fclose(tcp->outf)");
+	if (publish)
+		publish_tcp_output(tcp);
+	else
+		discard_tcp_output(tcp);
+}
+
+/* Whether the output of syscalls is staged until they complete.  */
+bool
+syscall_output_staged(void)
+{
+	return !is_complete_set(status_set, NUMBER_OF_STATUSES)
+	       || ts_nz(&latency_threshold);
+}
 
-	tcp->outf = tcp->staged_output_data->real_outf;
-	if (tcp->staged_output_data->memfptr) {
-		if (publish)
-			fputs_unlocked(tcp->staged_output_data->memfptr,
-				       tcp->outf);
-		else
-			debug_msg("syscall output dropped: %s",
-				  tcp->staged_output_data->memfptr);
+/*
+ * Whether the syscall of tcp that exited at ts, or that has not completed
+ * yet if ts is NULL, has taken longer than the --latency-threshold.
+ */
+bool
+syscall_latency_exceeded(struct tcb *tcp, const struct timespec *ts)
+{
+	struct timespec now, dt;
+
+	if (!ts_nz(&latency_threshold))
+		return true;
 
-		free(tcp->staged_output_data->memfptr);
-		tcp->staged_output_data->memfptr = NULL;
+	if (!ts) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ts = &now;
 	}
-	free(tcp->staged_output_data);
-	tcp->staged_output_data = NULL;
-#endif
+
+	ts_sub(&dt, ts, &tcp->etime);
+	return ts_cmp(&dt, &latency_threshold) > 0;
 }
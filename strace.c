@@ -15,6 +15,7 @@
 #include <fcntl.h>
 #include "ptrace.h"
 #include <signal.h>
+#include <setjmp.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #ifdef HAVE_PATHS_H
@@ -28,14 +29,18 @@
 #include <sys/utsname.h>
 #include <sys/prctl.h>
 
+#include "async_output.h"
 #include "kill_save_errno.h"
 #include "filter_seccomp.h"
 #include "largefile_wrappers.h"
+#include "fd_cache.h"
 #include "mmap_cache.h"
+#include "mmap_notify.h"
 #include "number_set.h"
 #include "ptrace_syscall_info.h"
 #include "scno.h"
 #include "printsiginfo.h"
+#include "print_utils.h"
 #include "trace_event.h"
 #include "xstring.h"
 #include "delay.h"
@@ -49,6 +54,10 @@ extern char *optarg;
 #ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 bool stack_trace_enabled;
+/* if this is true count the stack traces instead of printing them */
+bool stack_profile_enabled;
+static FILE *stack_profile_file;
+static bool stack_profile_by_time;
 #endif
 
 #define my_tkill(tid, sig) syscall(__NR_tkill, (tid), (sig))
@@ -69,6 +78,17 @@ bool followfork;
 bool output_separately;
 unsigned int ptrace_setoptions = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC
 				 | PTRACE_O_TRACEEXIT;
+static struct xlat_data async_output_str[] = {
+	{ ASYNC_OUTPUT_BLOCK,	"block" },
+	{ ASYNC_OUTPUT_DROP,	"drop" },
+	{ ASYNC_OUTPUT_SPILL,	"spill" },
+};
+#ifdef ENABLE_STACKTRACE
+static struct xlat_data stack_profile_weight_str[] = {
+	{ false,	"calls" },
+	{ true,		"time" },
+};
+#endif
 static struct xlat_data xflag_str[] = {
 	{ HEXSTR_NON_ASCII,	"non-ascii" },
 	{ HEXSTR_ALL,		"all" },
@@ -80,6 +100,9 @@ int Tflag_scale = 1000;
 int Tflag_width = 6;
 bool iflag;
 bool count_wallclock;
+bool count_histogram;
+bool io_summary_enabled;
+struct timespec latency_threshold;
 static int tflag_scale = 1000000000;
 static unsigned tflag_width = 0;
 static const char *tflag_format = NULL;
@@ -169,6 +192,13 @@ static struct tcb **tcbtab;
 static unsigned int nprocs;
 static size_t tcbtabsize;
 
+/*
+ * Open addressing hash table of active tcbs keyed by pid,
+ * its size is a power of 2 and at least twice the size of tcbtab.
+ */
+static struct tcb **pidtab;
+static size_t pidtab_size;
+
 static struct tcb_wait_data *tcb_wait_tab;
 static size_t tcb_wait_tab_size;
 
@@ -189,7 +219,22 @@ static volatile sig_atomic_t interrupted, restart_failed;
 static volatile int interrupted, restart_failed;
 #endif
 
+/* --summary-interval */
+static bool summary_interval_set;
+static struct timespec summary_interval;
+static FILE *summary_interval_log;
+#ifdef HAVE_SIG_ATOMIC_T
+static volatile sig_atomic_t summary_interval_expired;
+#else
+static volatile int summary_interval_expired;
+#endif
+/* Set while next_event() may be left by a jump from the signal handler. */
+static volatile sig_atomic_t summary_interval_jmp_armed;
+static sigjmp_buf summary_interval_jmp;
+
 static sigset_t timer_set;
+/* The signal of the summary interval timer only. */
+static sigset_t interval_timer_set;
 static void timer_sighandler(int);
 
 #ifndef HAVE_STRERROR
@@ -320,6 +365,9 @@ Filtering:\n\
                  print only syscalls that returned without an error code\n\
   -Z, --failed-only\n\
                  print only syscalls that returned with an error code\n\
+  --latency-threshold=DURATION\n\
+                 print only syscalls that took longer than DURATION\n\
+     duration:   microseconds or NUMBER{s|ms|us|ns}\n\
 \n\
 Output format:\n\
   -a COLUMN, --columns=COLUMN\n\
@@ -352,6 +400,15 @@ Output format:\n\
 "\
   -k, --stack-traces\n\
                  obtain stack trace between each syscall\n\
+  --stack-unwinder=UNWINDER\n\
+                 unwinder to obtain stack traces with:\n\
+                 " USE_UNWINDER " (default), fp (frame pointers)\n\
+  --stack-profile=FILE\n\
+                 count syscalls by stack trace instead of printing\n\
+                 stack traces, write folded stacks to FILE on exit\n\
+  --stack-profile-weight=WEIGHT\n\
+                 weight of folded stacks: calls (default), or time\n\
+                 (total time of syscalls in microseconds)\n\
 "
 #endif
 "\
@@ -361,6 +418,11 @@ Output format:\n\
                  open the file provided in the -o option in append mode\n\
   --output-separately\n\
                  output into separate files (by appending pid to file names)\n\
+  --output-async[=POLICY]\n\
+                 write the output to the file provided in the -o option\n\
+                 from a separate thread\n\
+     policy:     what to do when the thread falls behind: block (default),\n\
+                 drop, or spill (keep the output in memory)\n\
   -q, --quiet=attach,personality\n\
                  suppress messages about attaching, detaching, etc.\n\
   -qq, --quiet=attach,personality,exit\n\
@@ -410,14 +472,28 @@ Statistics:\n\
      units:      one of s, ms, us, ns; default is microseconds\n\
   -S SORTBY, --summary-sort-by=SORTBY\n\
                  sort syscall counts by: time, min-time, max-time, avg-time,\n\
-                 calls, errors, name, nothing (default %s)\n\
+                 p50, p90, p99, p999, calls, errors, name, nothing\n\
+                 (default %s)\n\
   -U COLUMNS, --summary-columns=COLUMNS\n\
                  show specific columns in the summary report: comma-separated\n\
                  list of time-percent, total-time, min-time, max-time, \n\
-                 avg-time, calls, errors, name\n\
+                 avg-time, p50, p90, p99, p999, calls, errors, name\n\
                  (default time-percent,total-time,avg-time,calls,errors,name)\n\
   -w, --summary-wall-clock\n\
                  summarise syscall latency (default is system time)\n\
+  --summary-histogram\n\
+                 print a histogram of call durations for each syscall\n\
+  --summary-interval=SECONDS\n\
+                 also print the summary of every SECONDS interval\n\
+  --summary-interval-log=FILE\n\
+                 write the summary of every interval to FILE as a JSON line\n\
+  --summary-by=KEY\n\
+                 also summarise syscalls per group of tracees with the same\n\
+                 KEY: one of pid, tgid, comm\n\
+  --summary-top=N\n\
+                 summarise N groups with the longest total time (default 10,\n\
+                 0 for all groups)\n\
+  --io-summary   also summarise reads and writes per file or socket\n\
 \n\
 Tampering:\n\
   -e inject=SET[:error=ERRNO|:retval=VALUE][:signal=SIG][:syscall=SYSCALL]\n\
@@ -647,18 +723,245 @@ outf_perror(const struct tcb * const tcp)
 		perror_msg("%s", outfname);
 }
 
+/*
+ * Output of every tracee is accumulated in its tcp->outbuf and written
+ * to tcp->outf with a single write syscall when the output is flushed,
+ * bypassing stdio buffering.  Unlike stdio buffers, outbufs are only
+ * as large as the longest line printed, and only tracees that have
+ * an incomplete line occupy them for a long time.
+ *
+ * All tracees that do not have separate output files share the log,
+ * so at most one of them, shared_outbuf_tcp, may have pending output
+ * for it at any given time: its outbuf is moved to log_batch as soon as
+ * another tracee starts printing to the shared log.  The output of all
+ * the events handled after one wait for events is collected this way
+ * in log_batch, which is written out before waiting for events again,
+ * or as soon as OUTBUF_WRITE_SIZE bytes are collected.
+ *
+ * When the output is staged for -z/-Z/-e status, tcp->outbuf serves
+ * as the staging area: it is not written out until the staged output
+ * is published, and dropping the staged output is just a matter
+ * of resetting tcp->outbuf_len.  A tracee with staged output never
+ * becomes shared_outbuf_tcp.
+ */
+enum {
+	/* Write out the output when there is that much pending.  */
+	OUTBUF_WRITE_SIZE = 64 * 1024,
+	/* Free outbufs larger than this after writing them out.  */
+	OUTBUF_KEEP_SIZE = 4096,
+};
+
+static struct tcb *shared_outbuf_tcp;
+
+static struct {
+	char *buf;
+	size_t len;
+	size_t size;
+} log_batch;
+
+static void
+trim_tcp_outbuf(struct tcb *const tcp)
+{
+	if (tcp->outbuf_size > OUTBUF_KEEP_SIZE) {
+		free(tcp->outbuf);
+		tcp->outbuf = NULL;
+		tcp->outbuf_size = 0;
+	}
+}
+
+/* Write len bytes of buf to fp, returns false on error.  */
+static bool
+write_output(FILE *const fp, const char *buf, size_t len)
+{
+	const int fd = fileno(fp);
+	bool ok = true;
+
+	/*
+	 * Something might have been written to fp
+	 * using stdio directly, it has to go first.
+	 */
+	if (fflush(fp))
+		ok = false;
+
+	if (async_output_policy != ASYNC_OUTPUT_NONE) {
+		async_output_write(fd, buf, len);
+		return ok;
+	}
+
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return ok;
+}
+
+static void
+write_log_batch(void)
+{
+	const size_t len = log_batch.len;
+
+	if (!len)
+		return;
+	log_batch.len = 0;
+
+	if (!write_output(shared_log, log_batch.buf, len) &&
+	    shared_log != stderr)
+		perror_msg("%s", outfname);
+
+	if (log_batch.size > OUTBUF_WRITE_SIZE * 2) {
+		free(log_batch.buf);
+		log_batch.buf = NULL;
+		log_batch.size = 0;
+	}
+}
+
+static void
+write_tcp_outbuf(struct tcb *const tcp)
+{
+	const size_t len = tcp->outbuf_len;
+
+	if (tcp->flags & TCB_STAGED_OUTPUT)
+		return;
+	if (shared_outbuf_tcp == tcp)
+		shared_outbuf_tcp = NULL;
+	if (!len)
+		return;
+	tcp->outbuf_len = 0;
+
+	if (tcp->outf == shared_log) {
+		while (log_batch.size - log_batch.len < len)
+			log_batch.buf = xgrowarray(log_batch.buf,
+						   &log_batch.size, 1);
+		memcpy(log_batch.buf + log_batch.len, tcp->outbuf, len);
+		log_batch.len += len;
+
+		if (log_batch.len >= OUTBUF_WRITE_SIZE)
+			write_log_batch();
+	} else if (!write_output(tcp->outf, tcp->outbuf, len)) {
+		outf_perror(tcp);
+	}
+
+	trim_tcp_outbuf(tcp);
+}
+
+/*
+ * Write out the output pending for tcp->outf, including the output
+ * of another tracee sharing the same log.
+ */
+static void
+sync_tcp_outbuf(struct tcb *const tcp)
+{
+	if (shared_outbuf_tcp && tcp->outf == shared_outbuf_tcp->outf)
+		write_tcp_outbuf(shared_outbuf_tcp);
+	write_tcp_outbuf(tcp);
+}
+
+/*
+ * Make sure all the output pending for tcp->outf is written,
+ * so that tcp->outf could be written to directly or closed.
+ */
+static void
+drain_tcp_output(struct tcb *const tcp)
+{
+	sync_tcp_outbuf(tcp);
+	if (tcp->outf == shared_log)
+		write_log_batch();
+	async_output_wait();
+}
+
+void
+flush_tracee_output(void)
+{
+	if (shared_outbuf_tcp)
+		write_tcp_outbuf(shared_outbuf_tcp);
+	write_log_batch();
+}
+
+/* Make room for at least len more bytes in tcp->outbuf.  */
+static void
+reserve_tcp_outbuf(struct tcb *const tcp, const size_t len)
+{
+	if (tcp->outf == shared_log && shared_outbuf_tcp != tcp
+	    && !(tcp->flags & TCB_STAGED_OUTPUT)) {
+		if (shared_outbuf_tcp)
+			write_tcp_outbuf(shared_outbuf_tcp);
+		shared_outbuf_tcp = tcp;
+	}
+
+	while (tcp->outbuf_size - tcp->outbuf_len < len)
+		tcp->outbuf = xgrowarray(tcp->outbuf, &tcp->outbuf_size, 1);
+}
+
+static void
+commit_tcp_outbuf(struct tcb *const tcp, const size_t len)
+{
+	tcp->outbuf_len += len;
+	tcp->curcol += len;
+
+	if (tcp->outbuf_len >= OUTBUF_WRITE_SIZE)
+		write_tcp_outbuf(tcp);
+}
+
+/* Let out the output staged in tcp->outbuf.  */
+void
+publish_tcp_output(struct tcb *const tcp)
+{
+	tcp->flags &= ~TCB_STAGED_OUTPUT;
+	reserve_tcp_outbuf(tcp, 0);
+
+	if (tcp->outbuf_len >= OUTBUF_WRITE_SIZE)
+		write_tcp_outbuf(tcp);
+}
+
+/* Drop the output staged in tcp->outbuf.  */
+void
+discard_tcp_output(struct tcb *const tcp)
+{
+	tcp->flags &= ~TCB_STAGED_OUTPUT;
+	if (tcp->outbuf_len)
+		debug_msg("syscall output dropped: %.*s",
+			  (int) tcp->outbuf_len, tcp->outbuf);
+	tcp->outbuf_len = 0;
+	trim_tcp_outbuf(tcp);
+}
+
 ATTRIBUTE_FORMAT((printf, 1, 0))
 static void
 tvprintf(const char *const fmt, va_list args)
 {
-	if (current_tcp) {
-		int n = vfprintf(current_tcp->outf, fmt, args);
-		if (n < 0) {
-			/* very unlikely due to vfprintf buffering */
-			outf_perror(current_tcp);
-		} else
-			current_tcp->curcol += n;
+	struct tcb *const tcp = current_tcp;
+
+	if (!tcp)
+		return;
+
+	va_list copy;
+	va_copy(copy, args);
+
+	reserve_tcp_outbuf(tcp, 1);
+	size_t avail = tcp->outbuf_size - tcp->outbuf_len;
+	int n = vsnprintf(tcp->outbuf + tcp->outbuf_len, avail, fmt, args);
+
+	if (n >= 0 && (size_t) n >= avail) {
+		reserve_tcp_outbuf(tcp, (size_t) n + 1);
+		avail = tcp->outbuf_size - tcp->outbuf_len;
+		n = vsnprintf(tcp->outbuf + tcp->outbuf_len, avail, fmt, copy);
+	}
+	va_end(copy);
+
+	if (n < 0) {
+		/* very unlikely, e.g. an invalid multibyte sequence */
+		outf_perror(tcp);
+		return;
 	}
+	commit_tcp_outbuf(tcp, n);
 }
 
 void
@@ -670,22 +973,54 @@ tprintf(const char *fmt, ...)
 	va_end(args);
 }
 
-#ifndef HAVE_FPUTS_UNLOCKED
-# define fputs_unlocked fputs
-#endif
+static void
+tprint_buf(const char *const buf, const size_t len)
+{
+	struct tcb *const tcp = current_tcp;
+
+	if (tcp) {
+		reserve_tcp_outbuf(tcp, len);
+		memcpy(tcp->outbuf + tcp->outbuf_len, buf, len);
+		commit_tcp_outbuf(tcp, len);
+	}
+}
 
 void
 tprints(const char *str)
 {
-	if (current_tcp) {
-		int n = fputs_unlocked(str, current_tcp->outf);
-		if (n >= 0) {
-			current_tcp->curcol += strlen(str);
-			return;
-		}
-		/* very unlikely due to fputs_unlocked buffering */
-		outf_perror(current_tcp);
+	if (current_tcp)
+		tprint_buf(str, strlen(str));
+}
+
+void
+tprint_int64(const int64_t val)
+{
+	char buf[sizeof("-18446744073709551616")];
+	char *p = buf;
+
+	if (val < 0) {
+		*p++ = '-';
+		p = sprint_uint64_dec(p, -(uint64_t) val);
+	} else {
+		p = sprint_uint64_dec(p, val);
 	}
+	tprint_buf(buf, p - buf);
+}
+
+void
+tprint_uint64(const uint64_t val)
+{
+	char buf[sizeof("18446744073709551616")];
+
+	tprint_buf(buf, sprint_uint64_dec(buf, val) - buf);
+}
+
+void
+tprint_xint64(const uint64_t val)
+{
+	char buf[sizeof("0xffffffffffffffff")];
+
+	tprint_buf(buf, sprint_uint64_hex(buf, val) - buf);
 }
 
 void
@@ -709,19 +1044,67 @@ tprintf_comment(const char *fmt, ...)
 	va_end(args);
 }
 
-static void
-flush_tcp_output(const struct tcb *const tcp)
+void
+set_current_tcp(const struct tcb *tcp)
 {
+	current_tcp = (struct tcb *) tcp;
+
+	/* Sync current_personality and stuff */
+	if (current_tcp)
+		set_personality(current_tcp->currpers);
+}
+
+void
+flush_tcp_output(struct tcb *const tcp)
+{
+#ifdef ENABLE_STACKTRACE
+	/* The stack trace is printed after the tracee is restarted.  */
+	if (stack_trace_enabled && unwind_tcb_print_pending(tcp)) {
+		struct tcb *const saved_tcp = current_tcp;
+
+		set_current_tcp(tcp);
+		unwind_tcb_print_deferred(tcp);
+		set_current_tcp(saved_tcp);
+	}
+#endif
+	sync_tcp_outbuf(tcp);
 	if (fflush(tcp->outf))
 		outf_perror(tcp);
 }
 
+/*
+ * The tcb whose output has ended with a complete line but has not been
+ * flushed yet.  The flush is postponed until the tracee is restarted
+ * so that the time the tracee spends in ptrace-stop does not include
+ * the time needed to write the output.
+ */
+static struct tcb *flush_pending_tcp;
+
+static void
+flush_pending_output(void)
+{
+	if (flush_pending_tcp) {
+		struct tcb *tcp = flush_pending_tcp;
+
+		flush_pending_tcp = NULL;
+		flush_tcp_output(tcp);
+	}
+}
+
+void
+defer_tcp_output_flush(struct tcb *const tcp)
+{
+	if (flush_pending_tcp != tcp)
+		flush_pending_output();
+	flush_pending_tcp = tcp;
+}
+
 void
 line_ended(void)
 {
 	if (current_tcp) {
 		current_tcp->curcol = 0;
-		flush_tcp_output(current_tcp);
+		defer_tcp_output_flush(current_tcp);
 	}
 	if (printing_tcp) {
 		printing_tcp->curcol = 0;
@@ -729,19 +1112,35 @@ line_ended(void)
 	}
 }
 
-void
-set_current_tcp(const struct tcb *tcp)
+static void
+print_interval_summary(void)
 {
-	current_tcp = (struct tcb *) tcp;
+	summary_interval_expired = 0;
 
-	/* Sync current_personality and stuff */
-	if (current_tcp)
-		set_personality(current_tcp->currpers);
+	if (printing_tcp && printing_tcp->curcol != 0) {
+		set_current_tcp(printing_tcp);
+		tprints(" <unfinished ...>\n");
+		flush_tcp_output(printing_tcp);
+		printing_tcp->curcol = 0;
+		printing_tcp = NULL;
+	}
+	flush_pending_output();
+	flush_tracee_output();
+	async_output_wait();
+
+	call_interval_summary(shared_log, summary_interval_log);
+	fflush(shared_log);
 }
 
 void
 printleader(struct tcb *tcp)
 {
+#ifdef ENABLE_STACKTRACE
+	/* A deferred stack trace belongs to the previous line.  */
+	if (stack_trace_enabled)
+		flush_pending_output();
+#endif
+
 	/* If -ff, "previous tcb we printed" is always the same as current,
 	 * because we have per-tcb output files.
 	 */
@@ -750,7 +1149,8 @@ printleader(struct tcb *tcp)
 
 	if (printing_tcp) {
 		set_current_tcp(printing_tcp);
-		if (!tcp->staged_output_data && printing_tcp->curcol != 0 &&
+		if (!(tcp->flags & TCB_STAGED_OUTPUT) &&
+		    printing_tcp->curcol != 0 &&
 		    (!output_separately || printing_tcp == tcp)) {
 			/*
 			 * case 1: we have a shared log (i.e. not -ff), and last line
@@ -843,6 +1243,86 @@ after_successful_attach(struct tcb *tcp, const unsigned int flags)
 #endif
 }
 
+static size_t
+pidtab_hash(const int pid)
+{
+	return ((unsigned int) pid * 2654435761U) & (pidtab_size - 1);
+}
+
+/*
+ * Returns the index of the pidtab slot that either contains the tcb
+ * of the given pid or is the empty slot where such a tcb would go.
+ */
+static size_t
+pidtab_lookup(const int pid)
+{
+	size_t i = pidtab_hash(pid);
+
+	while (pidtab[i] && pidtab[i]->pid != pid)
+		i = (i + 1) & (pidtab_size - 1);
+
+	return i;
+}
+
+static void
+pidtab_insert(struct tcb *const tcp)
+{
+	pidtab[pidtab_lookup(tcp->pid)] = tcp;
+}
+
+static void
+pidtab_remove(const struct tcb *const tcp)
+{
+	size_t i = pidtab_lookup(tcp->pid);
+
+	if (pidtab[i] != tcp)
+		return;
+
+	/*
+	 * Linear probing without tombstones: shift back the entries
+	 * of the cluster that follows the freed slot.
+	 */
+	for (size_t j = i;;) {
+		pidtab[i] = NULL;
+
+		for (;;) {
+			j = (j + 1) & (pidtab_size - 1);
+			if (!pidtab[j])
+				return;
+
+			const size_t h = pidtab_hash(pidtab[j]->pid);
+			if (i <= j ? (i < h && h <= j) : (i < h || h <= j))
+				continue;
+			break;
+		}
+
+		pidtab[i] = pidtab[j];
+		i = j;
+	}
+}
+
+static void
+pidtab_rehash(void)
+{
+	size_t new_size = pidtab_size ? pidtab_size : 1;
+
+	while (new_size < tcbtabsize * 2)
+		new_size *= 2;
+
+	if (new_size != pidtab_size) {
+		free(pidtab);
+		pidtab = xcalloc(new_size, sizeof(pidtab[0]));
+		pidtab_size = new_size;
+	} else {
+		memset(pidtab, 0, pidtab_size * sizeof(pidtab[0]));
+	}
+
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		if (tcbtab[i]->pid)
+			pidtab_insert(tcbtab[i]);
+	}
+}
+
 static void
 expand_tcbtab(void)
 {
@@ -863,6 +1343,8 @@ expand_tcbtab(void)
 	for (tcb_ptr = tcbtab + old_tcbtabsize;
 	    tcb_ptr < tcbtab + tcbtabsize; tcb_ptr++, newtcbs++)
 		*tcb_ptr = newtcbs;
+
+	pidtab_rehash();
 }
 
 static struct tcb *
@@ -883,6 +1365,7 @@ alloctcb(int pid)
 #if SUPPORTED_PERSONALITIES > 1
 			tcp->currpers = current_personality;
 #endif
+			pidtab_insert(tcp);
 			nprocs++;
 			debug_msg("new tcb for pid %d, active tcbs:%d",
 				  tcp->pid, nprocs);
@@ -955,16 +1438,20 @@ droptcb(struct tcb *tcp)
 	if (tcp->mmap_cache)
 		tcp->mmap_cache->free_fn(tcp, __func__);
 
+	fd_cache_free(tcp);
+
 	nprocs--;
 	debug_msg("dropped tcb for pid %d, %d remain", tcp->pid, nprocs);
 
 	if (tcp->outf) {
 		bool publish = true;
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
-			publish = is_number_in_set(STATUS_DETACHED, status_set);
-			strace_close_memstream(tcp, publish);
+		if (syscall_output_staged()) {
+			publish = is_number_in_set(STATUS_DETACHED, status_set)
+				  && syscall_latency_exceeded(tcp, NULL);
+			strace_close_staged_output(tcp, publish);
 		}
 
+		drain_tcp_output(tcp);
 		if (output_separately) {
 			if (tcp->curcol != 0 && publish)
 				fprintf(tcp->outf, " <detached ...>\n");
@@ -975,13 +1462,19 @@ droptcb(struct tcb *tcp)
 			flush_tcp_output(tcp);
 		}
 	}
+	free(tcp->outbuf);
 
 	if (current_tcp == tcp)
 		set_current_tcp(NULL);
 	if (printing_tcp == tcp)
 		printing_tcp = NULL;
+	if (flush_pending_tcp == tcp)
+		flush_pending_tcp = NULL;
+	if (shared_outbuf_tcp == tcp)
+		shared_outbuf_tcp = NULL;
 
 	list_remove(&tcp->wait_list);
+	pidtab_remove(tcp);
 
 	memset(tcp, 0, sizeof(*tcp));
 }
@@ -1722,7 +2215,14 @@ get_os_release(void)
 static void
 set_sighandler(int signo, void (*sighandler)(int), struct sigaction *oldact)
 {
-	const struct sigaction sa = { .sa_handler = sighandler };
+	/*
+	 * The summary interval timer signal is blocked in the handlers,
+	 * so that summary_interval_sighandler() never jumps out of them.
+	 */
+	const struct sigaction sa = {
+		.sa_handler = sighandler,
+		.sa_mask = interval_timer_set,
+	};
 	sigaction(signo, &sa, oldact);
 }
 
@@ -1743,6 +2243,60 @@ parse_interruptible_arg(const char *arg)
 			: (int) string_to_uint_upto(arg, NUM_INTR_OPTS - 1);
 }
 
+static void
+summary_interval_sighandler(int sig)
+{
+	summary_interval_expired = 1;
+
+	if (summary_interval_jmp_armed) {
+		summary_interval_jmp_armed = 0;
+		siglongjmp(summary_interval_jmp, 1);
+	}
+}
+
+/*
+ * The interval summary is printed by the tracer between events,
+ * so the timer only has to interrupt wait4() when the tracees make
+ * no syscalls.  The tracees are not stopped while it is printed.
+ */
+static void
+start_summary_interval_timer(void)
+{
+	struct sigevent sev = {
+		.sigev_notify = SIGEV_SIGNAL,
+		.sigev_signo = SIGRTMIN,
+	};
+	const struct itimerspec its = {
+		.it_interval = summary_interval,
+		.it_value = summary_interval,
+	};
+	timer_t timer;
+
+	set_sighandler(SIGRTMIN, summary_interval_sighandler, NULL);
+	if (timer_create(CLOCK_MONOTONIC, &sev, &timer))
+		perror_msg_and_die("timer_create");
+	if (timer_settime(timer, 0, &its, NULL))
+		perror_msg_and_die("timer_settime");
+
+	start_call_summary_intervals();
+}
+
+/* Parse a time interval, in seconds unless a unit is specified. */
+static int
+parse_seconds(const char *s, struct timespec *ts)
+{
+	const size_t len = strlen(s);
+	char buf[64];
+
+	if (!len || (size_t) snprintf(buf, sizeof(buf), "%s%s", s,
+				      strchr("0123456789.", s[len - 1])
+				      ? "s" : "")
+		    >= sizeof(buf))
+		return -1;
+
+	return parse_ts(buf, ts);
+}
+
 static int
 parse_ts_arg(const char *in_arg)
 {
@@ -1963,6 +2517,12 @@ init(int argc, char *argv[])
 	int tflag_short = 0;
 	bool columns_set = false;
 	bool sortby_set = false;
+	bool stack_unwinder_set = false;
+	const char *stack_profile_fname = NULL;
+	const char *summary_interval_log_fname = NULL;
+	bool summary_by_set = false;
+	bool summary_top_set = false;
+	uint64_t stack_profile_weight = -1ULL;
 
 	/*
 	 * We can initialise global_path_set only after tracing backend
@@ -2021,6 +2581,17 @@ init(int argc, char *argv[])
 		GETOPT_HEX_STR,
 		GETOPT_FOLLOWFORKS,
 		GETOPT_OUTPUT_SEPARATELY,
+		GETOPT_OUTPUT_ASYNC,
+		GETOPT_STACK_UNWINDER,
+		GETOPT_STACK_PROFILE,
+		GETOPT_STACK_PROFILE_WEIGHT,
+		GETOPT_SUMMARY_HISTOGRAM,
+		GETOPT_SUMMARY_INTERVAL,
+		GETOPT_SUMMARY_INTERVAL_LOG,
+		GETOPT_SUMMARY_BY,
+		GETOPT_SUMMARY_TOP,
+		GETOPT_IO_SUMMARY,
+		GETOPT_LATENCY_THRESHOLD,
 		GETOPT_TS,
 
 		GETOPT_QUAL_TRACE,
@@ -2051,10 +2622,17 @@ init(int argc, char *argv[])
 		{ "follow-forks",	no_argument,	   0, GETOPT_FOLLOWFORKS },
 		{ "output-separately",	no_argument,	   0,
 			GETOPT_OUTPUT_SEPARATELY },
+		{ "output-async",	optional_argument, 0, GETOPT_OUTPUT_ASYNC },
 		{ "help",		no_argument,	   0, 'h' },
 		{ "instruction-pointer", no_argument,      0, 'i' },
 		{ "interruptible",	required_argument, 0, 'I' },
 		{ "stack-traces",	no_argument,	   0, 'k' },
+		{ "stack-unwinder",	required_argument, 0,
+			GETOPT_STACK_UNWINDER },
+		{ "stack-profile",	required_argument, 0,
+			GETOPT_STACK_PROFILE },
+		{ "stack-profile-weight", required_argument, 0,
+			GETOPT_STACK_PROFILE_WEIGHT },
 		{ "output",		required_argument, 0, 'o' },
 		{ "summary-syscall-overhead", required_argument, 0, 'O' },
 		{ "attach",		required_argument, 0, 'p' },
@@ -2070,11 +2648,24 @@ init(int argc, char *argv[])
 		{ "no-abbrev",		no_argument,	   0, 'v' },
 		{ "version",		no_argument,	   0, 'V' },
 		{ "summary-wall-clock", no_argument,	   0, 'w' },
+		{ "summary-histogram",	no_argument,	   0,
+			GETOPT_SUMMARY_HISTOGRAM },
+		{ "summary-interval",	required_argument, 0,
+			GETOPT_SUMMARY_INTERVAL },
+		{ "summary-interval-log", required_argument, 0,
+			GETOPT_SUMMARY_INTERVAL_LOG },
+		{ "summary-by",		required_argument, 0,
+			GETOPT_SUMMARY_BY },
+		{ "summary-top",	required_argument, 0,
+			GETOPT_SUMMARY_TOP },
+		{ "io-summary",		no_argument,	   0, GETOPT_IO_SUMMARY },
 		{ "strings-in-hex",	optional_argument, 0, GETOPT_HEX_STR },
 		{ "const-print-style",	required_argument, 0, 'X' },
 		{ "successful-only",	no_argument,	   0, 'z' },
 		{ "failed-only",	no_argument,	   0, 'Z' },
 		{ "failing-only",	no_argument,	   0, 'Z' },
+		{ "latency-threshold",	required_argument, 0,
+			GETOPT_LATENCY_THRESHOLD },
 		{ "seccomp-bpf",	no_argument,	   0, GETOPT_SECCOMP },
 
 		{ "trace",	required_argument, 0, GETOPT_QUAL_TRACE },
@@ -2168,6 +2759,14 @@ init(int argc, char *argv[])
 		case GETOPT_OUTPUT_SEPARATELY:
 			output_separately = true;
 			break;
+		case GETOPT_OUTPUT_ASYNC:
+			async_output_policy =
+				find_arg_val(optarg, async_output_str,
+					     ASYNC_OUTPUT_BLOCK,
+					     ASYNC_OUTPUT_NONE);
+			if (async_output_policy == ASYNC_OUTPUT_NONE)
+				error_opt_arg(c, lopt, optarg);
+			break;
 		case 'F':
 			optF = 1;
 			break;
@@ -2189,6 +2788,40 @@ init(int argc, char *argv[])
 			error_msg_and_die("Stack traces (-k/--stack-traces "
 					  "option) are not supported by this "
 					  "build of strace");
+#endif
+			break;
+		case GETOPT_STACK_UNWINDER:
+#ifdef ENABLE_STACKTRACE
+			if (!unwind_set_unwinder(optarg))
+				error_opt_arg(c, lopt, optarg);
+			stack_unwinder_set = true;
+#else
+			error_msg_and_die("Stack traces (--stack-unwinder "
+					  "option) are not supported by this "
+					  "build of strace");
+#endif
+			break;
+		case GETOPT_STACK_PROFILE:
+#ifdef ENABLE_STACKTRACE
+			stack_profile_fname = optarg;
+#else
+			error_msg_and_die("Stack traces (--stack-profile "
+					  "option) are not supported by this "
+					  "build of strace");
+#endif
+			break;
+		case GETOPT_STACK_PROFILE_WEIGHT:
+#ifdef ENABLE_STACKTRACE
+			stack_profile_weight =
+				find_arg_val(optarg, stack_profile_weight_str,
+					     false, -1ULL);
+			if (stack_profile_weight == -1ULL)
+				error_opt_arg(c, lopt, optarg);
+			stack_profile_by_time = stack_profile_weight;
+#else
+			error_msg_and_die("Stack traces (--stack-profile-weight "
+					  "option) are not supported by this "
+					  "build of strace");
 #endif
 			break;
 		case 'o':
@@ -2263,6 +2896,39 @@ init(int argc, char *argv[])
 		case 'w':
 			count_wallclock = 1;
 			break;
+		case GETOPT_SUMMARY_HISTOGRAM:
+			count_histogram = true;
+			break;
+		case GETOPT_SUMMARY_INTERVAL:
+			if (parse_seconds(optarg, &summary_interval) < 0
+			    || !(summary_interval.tv_sec
+				 || summary_interval.tv_nsec))
+				error_opt_arg(c, lopt, optarg);
+			summary_interval_set = true;
+			break;
+		case GETOPT_SUMMARY_INTERVAL_LOG:
+			summary_interval_log_fname = optarg;
+			break;
+		case GETOPT_SUMMARY_BY:
+			if (set_count_summary_by(optarg) < 0)
+				error_opt_arg(c, lopt, optarg);
+			summary_by_set = true;
+			break;
+		case GETOPT_SUMMARY_TOP:
+			i = string_to_uint(optarg);
+			if (i < 0)
+				error_opt_arg(c, lopt, optarg);
+			set_count_summary_top(i);
+			summary_top_set = true;
+			break;
+		case GETOPT_IO_SUMMARY:
+			io_summary_enabled = true;
+			break;
+		case GETOPT_LATENCY_THRESHOLD:
+			if (parse_ts(optarg, &latency_threshold) < 0
+			    || !ts_nz(&latency_threshold))
+				error_opt_arg(c, lopt, optarg);
+			break;
 		case 'x':
 			xflag++;
 			break;
@@ -2448,6 +3114,34 @@ init(int argc, char *argv[])
 				   " (-c/--summary-only or -C/--summary)");
 	}
 
+	if (summary_interval_set && !cflag) {
+		error_msg_and_help("--summary-interval must be given"
+				   " with (-c/--summary-only or -C/--summary)");
+	}
+
+	if (summary_interval_log_fname && !summary_interval_set) {
+		error_msg_and_help("--summary-interval-log must be given"
+				   " with --summary-interval");
+	}
+
+	if (summary_by_set && !cflag) {
+		error_msg_and_help("--summary-by must be given with"
+				   " (-c/--summary-only or -C/--summary)");
+	}
+
+	if (summary_top_set && !summary_by_set)
+		error_msg("--summary-top has no effect without --summary-by");
+
+	if (io_summary_enabled && !cflag) {
+		error_msg_and_help("--io-summary must be given with"
+				   " (-c/--summary-only or -C/--summary)");
+	}
+
+	if (count_histogram && !cflag) {
+		error_msg_and_help("--summary-histogram must be given with"
+				   " (-c/--summary-only or -C/--summary)");
+	}
+
 	if (columns_set && !cflag) {
 		error_msg_and_help("-U/--summary-columns must be given with"
 				   " (-c/--summary-only or -C/--summary)");
@@ -2474,11 +3168,32 @@ init(int argc, char *argv[])
 		if (Tflag)
 			error_msg("-T/--syscall-times has no effect "
 				  "with -c/--summary-only");
+		if (ts_nz(&latency_threshold))
+			error_msg("--latency-threshold has no effect "
+				  "with -c/--summary-only");
 		if (!number_set_array_is_empty(decode_fd_set, 0))
 			error_msg("-y/--decode-fds has no effect "
 				  "with -c/--summary-only");
 	}
 
+	if (stack_unwinder_set && !stack_trace_enabled && !stack_profile_fname)
+		error_msg("--stack-unwinder has no effect "
+			  "without -k/--stack-traces or --stack-profile");
+
+	if (stack_profile_weight != -1ULL && !stack_profile_fname)
+		error_msg("--stack-profile-weight has no effect "
+			  "without --stack-profile");
+
+#ifdef ENABLE_STACKTRACE
+	if (stack_profile_fname) {
+		if (stack_trace_enabled)
+			error_msg("-k/--stack-traces has no effect "
+				  "with --stack-profile");
+		stack_trace_enabled = true;
+		stack_profile_enabled = true;
+	}
+#endif
+
 	if (!outfname) {
 		if (output_separately && !followfork)
 			error_msg("--output-separately has no effect "
@@ -2486,13 +3201,13 @@ init(int argc, char *argv[])
 		if (open_append)
 			error_msg("-A/--output-append-mode has no effect "
 				  "without -o/--output");
+		if (async_output_policy != ASYNC_OUTPUT_NONE) {
+			error_msg("--output-async has no effect "
+				  "without -o/--output");
+			async_output_policy = ASYNC_OUTPUT_NONE;
+		}
 	}
 
-#ifndef HAVE_OPEN_MEMSTREAM
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
-		error_msg_and_help("open_memstream is required to use -z, -Z, or -e status");
-#endif
-
 	if (zflags > 1)
 		error_msg("Only the last of "
 			  "-z/--successful-only/-Z/--failed-only options will "
@@ -2584,6 +3299,13 @@ init(int argc, char *argv[])
 		output_separately = false;
 	}
 
+#ifdef ENABLE_STACKTRACE
+	if (stack_profile_fname)
+		stack_profile_file = strace_fopen(stack_profile_fname);
+#endif
+	if (summary_interval_log_fname)
+		summary_interval_log = strace_fopen(summary_interval_log_fname);
+
 	if (!outfname || outfname[0] == '|' || outfname[0] == '!') {
 		setvbuf(shared_log, NULL, _IOLBF, 0);
 	}
@@ -2639,6 +3361,14 @@ init(int argc, char *argv[])
 			free(new_environ);
 	}
 
+	sigemptyset(&timer_set);
+	sigaddset(&timer_set, SIGALRM);
+	sigemptyset(&interval_timer_set);
+	if (summary_interval_set) {
+		sigaddset(&timer_set, SIGRTMIN);
+		sigaddset(&interval_timer_set, SIGRTMIN);
+	}
+
 	set_sighandler(SIGTTOU, SIG_IGN, NULL);
 	set_sighandler(SIGTTIN, SIG_IGN, NULL);
 	if (opt_intr != INTR_ANYWHERE) {
@@ -2657,11 +3387,12 @@ init(int argc, char *argv[])
 		set_sighandler(SIGTERM, interactive ? interrupt : SIG_IGN, NULL);
 	}
 
-	sigemptyset(&timer_set);
-	sigaddset(&timer_set, SIGALRM);
 	sigprocmask(SIG_BLOCK, &timer_set, NULL);
 	set_sighandler(SIGALRM, timer_sighandler, NULL);
 
+	if (summary_interval_set)
+		start_summary_interval_timer();
+
 	if (nprocs != 0 || daemonized_tracer)
 		startup_attach();
 
@@ -2677,26 +3408,10 @@ init(int argc, char *argv[])
 static struct tcb *
 pid2tcb(const int pid)
 {
-	if (pid <= 0)
+	if (pid <= 0 || !pidtab_size)
 		return NULL;
 
-#define PID2TCB_CACHE_SIZE 1024U
-#define PID2TCB_CACHE_MASK (PID2TCB_CACHE_SIZE - 1)
-
-	static struct tcb *pid2tcb_cache[PID2TCB_CACHE_SIZE];
-	struct tcb **const ptcp = &pid2tcb_cache[pid & PID2TCB_CACHE_MASK];
-	struct tcb *tcp = *ptcp;
-
-	if (tcp && tcp->pid == pid)
-		return tcp;
-
-	for (unsigned int i = 0; i < tcbtabsize; ++i) {
-		tcp = tcbtab[i];
-		if (tcp->pid == pid)
-			return *ptcp = tcp;
-	}
-
-	return NULL;
+	return pidtab[pidtab_lookup(pid)];
 }
 
 static void
@@ -2719,6 +3434,10 @@ cleanup(int fatal_sig)
 		}
 		detach(tcp);
 	}
+
+	/* Write out the output that is still pending or queued.  */
+	flush_tracee_output();
+	async_output_finish();
 }
 
 static void
@@ -2838,6 +3557,8 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 	if (!execve_thread)
 		return NULL;
 
+	drain_tcp_output(execve_thread);
+	drain_tcp_output(tcp);
 	if (execve_thread->curcol != 0) {
 		/*
 		 * One case we are here is -ff, try
@@ -2845,20 +3566,38 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 		 * Another case is demonstrated by
 		 * tests/maybe_switch_current_tcp.c
 		 */
-		fprintf(execve_thread->outf, " <pid changed to %d ...>\n", pid);
+		struct tcb *const saved_tcp = current_tcp;
+
+		set_current_tcp(execve_thread);
+		tprintf(" <pid changed to %d ...>\n", pid);
+		set_current_tcp(saved_tcp);
+		drain_tcp_output(execve_thread);
 		/*execve_thread->curcol = 0; - no need, see code below */
 	}
-	/* Swap output FILEs and memstream (needed for -ff) */
+	/*
+	 * Swap output FILEs and output buffers, the latter are empty
+	 * unless the output is staged (needed for -ff).
+	 */
 	FILE *fp = execve_thread->outf;
 	execve_thread->outf = tcp->outf;
 	tcp->outf = fp;
-	if (execve_thread->staged_output_data || tcp->staged_output_data) {
-		struct staged_output_data *staged_output_data;
 
-		staged_output_data = execve_thread->staged_output_data;
-		execve_thread->staged_output_data = tcp->staged_output_data;
-		tcp->staged_output_data = staged_output_data;
-	}
+	char *outbuf = execve_thread->outbuf;
+	execve_thread->outbuf = tcp->outbuf;
+	tcp->outbuf = outbuf;
+
+	size_t outbuf_len = execve_thread->outbuf_len;
+	execve_thread->outbuf_len = tcp->outbuf_len;
+	tcp->outbuf_len = outbuf_len;
+
+	size_t outbuf_size = execve_thread->outbuf_size;
+	execve_thread->outbuf_size = tcp->outbuf_size;
+	tcp->outbuf_size = outbuf_size;
+
+	const int staged = execve_thread->flags & TCB_STAGED_OUTPUT;
+	execve_thread->flags = (execve_thread->flags & ~TCB_STAGED_OUTPUT)
+			       | (tcp->flags & TCB_STAGED_OUTPUT);
+	tcp->flags = (tcp->flags & ~TCB_STAGED_OUTPUT) | staged;
 
 	/* And their column positions */
 	execve_thread->curcol = tcp->curcol;
@@ -2867,7 +3606,9 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 	droptcb(tcp);
 	/* Switch to the thread, reusing leader's outfile and pid */
 	tcp = execve_thread;
+	pidtab_remove(tcp);
 	tcp->pid = pid;
+	pidtab_insert(tcp);
 	if (cflag != CFLAG_ONLY_STATS) {
 		if (!is_number_in_set(QUIET_THREAD_EXECVE, quiet_set)) {
 			printleader(tcp);
@@ -2876,11 +3617,11 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 			line_ended();
 		}
 		/*
-		 * Need to reopen memstream for thread
+		 * Need to restart output staging for thread
 		 * as we closed it in droptcb.
 		 */
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
-			strace_open_memstream(tcp);
+		if (syscall_output_staged())
+			strace_open_staged_output(tcp);
 		tcp->flags |= TCB_REPRINT;
 	}
 
@@ -3011,9 +3752,10 @@ print_event_exit(struct tcb *tcp)
 	tprints(") ");
 	tabto();
 	tprints("= ?\n");
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
-		bool publish = is_number_in_set(STATUS_UNFINISHED, status_set);
-		strace_close_memstream(tcp, publish);
+	if (syscall_output_staged()) {
+		bool publish = is_number_in_set(STATUS_UNFINISHED, status_set)
+			       && syscall_latency_exceeded(tcp, NULL);
+		strace_close_staged_output(tcp, publish);
 	}
 	line_ended();
 }
@@ -3066,6 +3808,9 @@ next_event(void)
 	if (interrupted)
 		return NULL;
 
+	if (summary_interval_expired)
+		print_interval_summary();
+
 	invalidate_umove_cache();
 
 	struct tcb *tcp = NULL;
@@ -3109,7 +3854,21 @@ next_event(void)
 			return NULL;
 	}
 
-	const bool unblock_delay_timer = is_delay_timer_armed();
+	/*
+	 * The output of the events handled since the last wait
+	 * is not held back while waiting for new events.
+	 */
+	flush_tracee_output();
+
+	/*
+	 * The summary interval timer interrupts wait4()
+	 * when the tracees make no syscalls; the delay timer
+	 * signal, however, is left blocked unless the delay
+	 * timer is already created.
+	 */
+	const sigset_t *const unblock_set =
+		is_delay_timer_armed() ? &timer_set :
+		summary_interval_set ? &interval_timer_set : NULL;
 
 	/*
 	 * The window of opportunity to handle expirations
@@ -3118,8 +3877,8 @@ next_event(void)
 	 * Unblock the signal handler for the delay timer
 	 * iff the delay timer is already created.
 	 */
-	if (unblock_delay_timer)
-		sigprocmask(SIG_UNBLOCK, &timer_set, NULL);
+	if (unblock_set)
+		sigprocmask(SIG_UNBLOCK, unblock_set, NULL);
 
 	/*
 	 * If the delay timer has expired, then its expiration
@@ -3128,11 +3887,46 @@ next_event(void)
 	 * If the delay timer expires during wait4(),
 	 * then the system call will be interrupted and
 	 * the expiration will be handled by the signal handler.
+	 *
+	 * The summary interval that has expired while the signal
+	 * was blocked is handled without waiting, as if wait4()
+	 * was interrupted.  The summary interval timer may also
+	 * expire after the check but before wait4() starts to sleep,
+	 * and wait4() would not be interrupted then.  To close this
+	 * window, the handler jumps out of a waitid() call that waits
+	 * for an event without consuming it, so no status is lost
+	 * when the jump is taken after waitid() has returned;
+	 * wait4() is called after that and does not sleep.
 	 */
 	int status;
 	struct rusage ru;
-	int pid = wait4(-1, &status, __WALL, (cflag ? &ru : NULL));
-	int wait_errno = errno;
+	int pid;
+	int wait_errno;
+
+	if (summary_interval_set && sigsetjmp(summary_interval_jmp, 1)) {
+		pid = -1;
+		wait_errno = EINTR;
+	} else {
+		int rc = 0;
+
+		if (summary_interval_set) {
+			siginfo_t si;
+
+			summary_interval_jmp_armed = 1;
+			if (!summary_interval_expired)
+				rc = waitid(P_ALL, 0, &si, WEXITED | WSTOPPED
+					    | __WALL | WNOWAIT);
+			summary_interval_jmp_armed = 0;
+		}
+
+		if (summary_interval_expired || (rc < 0 && errno == EINTR)) {
+			pid = -1;
+			wait_errno = EINTR;
+		} else {
+			pid = wait4(-1, &status, __WALL, (cflag ? &ru : NULL));
+			wait_errno = errno;
+		}
+	}
 
 	/*
 	 * The window of opportunity to handle expirations
@@ -3141,8 +3935,8 @@ next_event(void)
 	 * Block the signal handler for the delay timer
 	 * iff it was unblocked earlier.
 	 */
-	if (unblock_delay_timer) {
-		sigprocmask(SIG_BLOCK, &timer_set, NULL);
+	if (unblock_set) {
+		sigprocmask(SIG_BLOCK, unblock_set, NULL);
 
 		if (restart_failed)
 			return NULL;
@@ -3312,6 +4106,17 @@ next_event(void)
 		if (extra_tcp)
 			break;
 
+		/*
+		 * Once every tracee has an event queued, the only thing
+		 * wait4(WNOHANG) could return is either an event of a new
+		 * tracee or a second event of a queued one, and both can
+		 * wait for the next blocking wait4() call.  This saves
+		 * a wait4() call per event in the common case of tracing
+		 * a single process.
+		 */
+		if (wait_tab_pos >= nprocs)
+			break;
+
 next_event_wait_next:
 		pid = wait4(-1, &status, __WALL | WNOHANG, (cflag ? &ru : NULL));
 		wait_errno = errno;
@@ -3504,6 +4309,8 @@ dispatch_event(const struct tcb_wait_data *wd)
 	case TE_STOP_BEFORE_EXECVE:
 		/* The syscall succeeded, clear the flag.  */
 		current_tcp->flags &= ~TCB_CHECK_EXEC_SYSCALL;
+		/* The command name has changed.  */
+		current_tcp->count_group = 0;
 		/*
 		 * Check that we are inside syscall now (next event after
 		 * PTRACE_EVENT_EXEC should be for syscall exiting).  If it is
@@ -3529,6 +4336,14 @@ dispatch_event(const struct tcb_wait_data *wd)
 			}
 		}
 
+		/*
+		 * The address space has been replaced.  Report it here
+		 * rather than at the exit of execve, which is not stopped at
+		 * if seccomp-bpf filters it out.
+		 */
+		if (mmap_notify_has_clients())
+			mmap_notify_report(current_tcp, MMAP_NOTIFY_EXECVE);
+
 		if (detach_on_execve) {
 			if (current_tcp->flags & TCB_SKIP_DETACH_ON_FIRST_EXEC) {
 				current_tcp->flags &= ~TCB_SKIP_DETACH_ON_FIRST_EXEC;
@@ -3654,8 +4469,22 @@ terminate(void)
 	int sig = interrupted;
 
 	cleanup(sig);
-	if (cflag)
+	if (cflag) {
 		call_summary(shared_log);
+		async_output_print_stats(shared_log);
+	}
+	print_umove_cache_stats();
+#ifdef ENABLE_STACKTRACE
+	if (stack_profile_enabled) {
+		unwind_profile_print(stack_profile_file,
+				     stack_profile_by_time);
+		fclose(stack_profile_file);
+	}
+	if (stack_trace_enabled)
+		unwind_print_stats();
+#endif
+	if (summary_interval_log)
+		fclose(summary_interval_log);
 	fflush(NULL);
 	if (shared_log != stderr)
 		fclose(shared_log);
@@ -3700,6 +4529,7 @@ main(int argc, char *argv[])
 	exit_code = !nprocs;
 
 	while (dispatch_event(next_event()))
-		;
+		flush_pending_output();
+	flush_pending_output();
 	terminate();
 }
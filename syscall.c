@@ -13,7 +13,9 @@
  */
 
 #include "defs.h"
+#include "fd_cache.h"
 #include "get_personality.h"
+#include "mmap_cache.h"
 #include "mmap_notify.h"
 #include "native_defs.h"
 #include "ptrace.h"
@@ -444,11 +446,17 @@ print_err_ret(kernel_ulong_t ret, unsigned long u_error)
 {
 	const char *u_error_str = err_name(u_error);
 
-	if (u_error_str)
-		tprintf("= %" PRI_kld " %s (%s)",
-			ret, u_error_str, strerror(u_error));
-	else
-		tprintf("= %" PRI_kld " (errno %lu)", ret, u_error);
+	tprints("= ");
+	tprint_int64((kernel_long_t) ret);
+	if (u_error_str) {
+		tprints(" ");
+		tprints(u_error_str);
+		tprints(" (");
+		tprints(strerror(u_error));
+		tprints(")");
+	} else {
+		tprintf(" (errno %lu)", u_error);
+	}
 }
 
 static long get_regs(struct tcb *);
@@ -585,7 +593,8 @@ syscall_entering_decode(struct tcb *tcp)
 		return res;
 	if (res != 1 || (res = get_syscall_args(tcp)) != 1) {
 		printleader(tcp);
-		tprintf("%s(", tcp_sysent(tcp)->sys_name);
+		tprints(tcp_sysent(tcp)->sys_name);
+		tprints("(");
 		/*
 		 * " <unavailable>" will be added later by the code which
 		 * detects ptrace errors.
@@ -593,6 +602,8 @@ syscall_entering_decode(struct tcb *tcp)
 		return res;
 	}
 
+	fd_cache_syscall(tcp);
+
 #ifdef SYS_syscall_subcall
 	if (tcp_sysent(tcp)->sen == SEN_syscall)
 		decode_syscall_subcall(tcp);
@@ -652,25 +663,27 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	if (inject(tcp))
 		tamper_with_syscall_entering(tcp, sig);
 
-	if (cflag == CFLAG_ONLY_STATS) {
-		return 0;
-	}
-
 #ifdef ENABLE_STACKTRACE
 	if (stack_trace_enabled &&
+	    (cflag != CFLAG_ONLY_STATS || stack_profile_enabled) &&
 	    !check_exec_syscall(tcp) &&
 	    tcp_sysent(tcp)->sys_flags & STACKTRACE_CAPTURE_ON_ENTER) {
 		unwind_tcb_capture(tcp);
 	}
 #endif
 
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
-		strace_open_memstream(tcp);
+	if (cflag == CFLAG_ONLY_STATS) {
+		return 0;
+	}
+
+	if (syscall_output_staged())
+		strace_open_staged_output(tcp);
 
 	printleader(tcp);
-	tprintf("%s(", tcp_sysent(tcp)->sys_name);
+	tprints(tcp_sysent(tcp)->sys_name);
+	tprints("(");
 	int res = raw(tcp) ? printargs(tcp) : tcp_sysent(tcp)->sys_func(tcp);
-	fflush(tcp->outf);
+	defer_tcp_output_flush(tcp);
 	return res;
 }
 
@@ -681,7 +694,8 @@ syscall_entering_finish(struct tcb *tcp, int res)
 	tcp->sys_func_rval = res;
 
 	/* Measure the entrance time as late as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
+	if ((Tflag || cflag || stack_profile_enabled
+	     || ts_nz(&latency_threshold)) && !filtered(tcp))
 		clock_gettime(CLOCK_MONOTONIC, &tcp->etime);
 
 	/* Start tracking system time */
@@ -714,11 +728,20 @@ int
 syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 {
 	/* Measure the exit time as early as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
+	if ((Tflag || cflag || stack_profile_enabled
+	     || ts_nz(&latency_threshold)) && !filtered(tcp))
 		clock_gettime(CLOCK_MONOTONIC, pts);
 
-	if (tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
-		mmap_notify_report(tcp);
+	if ((tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
+	    && mmap_notify_has_clients()) {
+		/* The clients follow the changes using the syscall result.  */
+		mmap_notify_report(tcp, get_syscall_result(tcp) > 0
+					? MMAP_NOTIFY_SYSCALL
+					: MMAP_NOTIFY_SYSCALL_NORESULT);
+	}
+	mmap_cache_syscall(tcp);
+	fd_cache_syscall(tcp);
+	sockaddr_cache_syscall(tcp);
 
 	if (filtered(tcp))
 		return 0;
@@ -747,7 +770,8 @@ print_syscall_resume(struct tcb *tcp)
 	 * "strace -ff -oLOG test/threaded_execve" corner case.
 	 * It's the only case when -ff mode needs reprinting.
 	 */
-	if ((!output_separately && printing_tcp != tcp && !tcp->staged_output_data)
+	if ((!output_separately && printing_tcp != tcp
+	     && !(tcp->flags & TCB_STAGED_OUTPUT))
 	    || (tcp->flags & TCB_REPRINT)) {
 		tcp->flags &= ~TCB_REPRINT;
 		printleader(tcp);
@@ -761,6 +785,11 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 	if (syscall_tampered(tcp) || inject_delay_exit(tcp))
 		tamper_with_syscall_exiting(tcp);
 
+#ifdef ENABLE_STACKTRACE
+	if (stack_profile_enabled)
+		unwind_tcb_profile(tcp, ts);
+#endif
+
 	if (cflag) {
 		count_syscall(tcp, ts);
 		if (cflag == CFLAG_ONLY_STATS) {
@@ -777,10 +806,11 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 		tprints(") ");
 		tabto();
 		tprints("= ? <unavailable>\n");
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+		if (syscall_output_staged()) {
 			bool publish = is_number_in_set(STATUS_UNAVAILABLE,
-							status_set);
-			strace_close_memstream(tcp, publish);
+							status_set)
+				       && syscall_latency_exceeded(tcp, ts);
+			strace_close_staged_output(tcp, publish);
 		}
 		line_ended();
 		return res;
@@ -797,14 +827,19 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 			sys_res = tcp_sysent(tcp)->sys_func(tcp);
 	}
 
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+	if (syscall_output_staged()) {
 		bool publish = syserror(tcp)
 			       && is_number_in_set(STATUS_FAILED, status_set);
 		publish |= !syserror(tcp)
 			   && is_number_in_set(STATUS_SUCCESSFUL, status_set);
-		strace_close_memstream(tcp, publish);
+		publish &= syscall_latency_exceeded(tcp, ts);
+		strace_close_staged_output(tcp, publish);
 		if (!publish) {
 			line_ended();
+#ifdef ENABLE_STACKTRACE
+			if (stack_trace_enabled)
+				unwind_tcb_discard(tcp);
+#endif
 			return 0;
 		}
 	}
@@ -813,10 +848,12 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 	tabto();
 
 	if (raw(tcp)) {
-		if (tcp->u_error)
+		if (tcp->u_error) {
 			print_err_ret(tcp->u_rval, tcp->u_error);
-		else
-			tprintf("= %#" PRI_klx, tcp->u_rval);
+		} else {
+			tprints("= ");
+			tprint_xint64((kernel_ulong_t) tcp->u_rval);
+		}
 
 		if (syscall_tampered(tcp))
 			tprints(" (INJECTED)");
@@ -891,12 +928,13 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 			case RVAL_HEX:
 #if ANY_WORDSIZE_LESS_THAN_KERNEL_LONG
 				if (current_klongsize < sizeof(tcp->u_rval)) {
-					tprintf("= %#x",
-						(unsigned int) tcp->u_rval);
+					tprints("= ");
+					tprint_xint64((unsigned int) tcp->u_rval);
 				} else
 #endif
 				{
-					tprintf("= %#" PRI_klx, tcp->u_rval);
+					tprints("= ");
+					tprint_xint64((kernel_ulong_t) tcp->u_rval);
 				}
 				break;
 			case RVAL_OCTAL:
@@ -906,12 +944,13 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 			case RVAL_UDECIMAL:
 #if ANY_WORDSIZE_LESS_THAN_KERNEL_LONG
 				if (current_klongsize < sizeof(tcp->u_rval)) {
-					tprintf("= %u",
-						(unsigned int) tcp->u_rval);
+					tprints("= ");
+					tprint_uint64((unsigned int) tcp->u_rval);
 				} else
 #endif
 				{
-					tprintf("= %" PRI_klu, tcp->u_rval);
+					tprints("= ");
+					tprint_uint64((kernel_ulong_t) tcp->u_rval);
 				}
 				break;
 			case RVAL_FD:
@@ -924,7 +963,8 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 					tprints("= ");
 					printfd(tcp, tcp->u_rval);
 				} else {
-					tprintf("= %" PRI_kld, tcp->u_rval);
+					tprints("= ");
+					tprint_int64(tcp->u_rval);
 				}
 				break;
 			default:
@@ -1294,6 +1334,32 @@ get_stack_pointer(struct tcb *tcp, kernel_ulong_t *sp)
 #endif
 }
 
+bool
+get_frame_pointer(struct tcb *tcp, kernel_ulong_t *fp)
+{
+#if defined ARCH_FP_REG
+	if (get_regs(tcp) < 0)
+		return false;
+	*fp = (kernel_ulong_t) ARCH_FP_REG;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool
+get_link_register(struct tcb *tcp, kernel_ulong_t *lr)
+{
+#if defined ARCH_LR_REG
+	if (get_regs(tcp) < 0)
+		return false;
+	*lr = (kernel_ulong_t) ARCH_LR_REG;
+	return true;
+#else
+	return false;
+#endif
+}
+
 static int
 get_syscall_regs(struct tcb *tcp)
 {
@@ -0,0 +1,74 @@
+/*
+ * Check that strace -f -y notices changes of descriptor paths
+ * made by syscalls that are not traced.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static char dir[PATH_MAX + 1];
+static int pid;
+
+static void
+do_fsync(const int fd, const char *const name, const char *const suffix)
+{
+	int rc = fsync(fd);
+
+	printf("%-5d fsync(%d<", pid, fd);
+	print_quoted_string_ex(dir, false, ">:");
+	printf("/%s%s>) = %s\n", name, suffix, sprintrc(rc));
+}
+
+int
+main(void)
+{
+	static const char name1[] = "fsync-y-f.sample1";
+	static const char name2[] = "fsync-y-f.sample2";
+
+	pid = getpid();
+	if (!getcwd(dir, sizeof(dir)))
+		perror_msg_and_fail("getcwd");
+
+	int fd = open(name1, O_RDONLY|O_CREAT, 0600);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", name1);
+
+	do_fsync(fd, name1, "");
+	do_fsync(fd, name1, "");
+
+	if (rename(name1, name2))
+		perror_msg_and_fail("rename");
+	do_fsync(fd, name2, "");
+
+	int fd1 = open(name1, O_RDONLY|O_CREAT, 0600);
+	if (fd1 < 0)
+		perror_msg_and_fail("open: %s", name1);
+	if (dup2(fd1, fd) != fd)
+		perror_msg_and_fail("dup2");
+	do_fsync(fd, name1, "");
+
+	if (close(fd) || close(fd1))
+		perror_msg_and_fail("close");
+	if (open(name2, O_RDONLY) != fd)
+		perror_msg_and_fail("open: %s", name2);
+	do_fsync(fd, name2, "");
+
+	if (unlink(name2))
+		perror_msg_and_fail("unlink: %s", name2);
+	do_fsync(fd, name2, " (deleted)");
+
+	if (unlink(name1))
+		perror_msg_and_fail("unlink: %s", name1);
+
+	printf("%-5d +++ exited with 0 +++\n", pid);
+	return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Check that stack traces are resolved after execve.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <unistd.h>
+#include "stack-fcall.h"
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2) {
+		/* Make the tracer look at the mappings before execve.  */
+		f0(0, (unsigned long) (void *) main);
+
+		char *const args[] = { argv[0], (char *) "execve", NULL };
+		execve(args[0], args, environ);
+		perror_msg_and_fail("execve: %s", args[0]);
+	}
+
+	f0(0, (unsigned long) (void *) main);
+	f0(1, (unsigned long) (void *) main);
+	return 0;
+}
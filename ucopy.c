@@ -13,6 +13,7 @@
  */
 
 #include "defs.h"
+#include <limits.h>
 #include <sys/uio.h>
 
 #include "scno.h"
@@ -40,6 +41,11 @@ static ssize_t strace_process_vm_readv(pid_t pid,
 # define process_vm_readv strace_process_vm_readv
 #endif /* !HAVE_PROCESS_VM_READV */
 
+/* Statistics of tracee memory reads, reported in debug mode.  */
+static unsigned long umove_cache_hits;
+static unsigned long umove_cache_misses;
+static unsigned long process_vm_readv_calls;
+
 static ssize_t
 process_read_mem(const pid_t pid, void *const laddr,
 		 void *const raddr, const size_t len)
@@ -53,6 +59,7 @@ process_read_mem(const pid_t pid, void *const laddr,
 		.iov_len = len
 	};
 
+	++process_vm_readv_calls;
 	const ssize_t rc = process_vm_readv(pid, &local, 1, &remote, 1, 0);
 	if (rc < 0 && errno == ENOSYS)
 		process_vm_readv_not_supported = true;
@@ -60,19 +67,118 @@ process_read_mem(const pid_t pid, void *const laddr,
 	return rc;
 }
 
-static int cached_idx = -1;
-static unsigned long cached_raddr[2];
+/*
+ * A small set-associative cache of tracee memory pages.
+ *
+ * Decoders of structures like msghdr, iovec, or netlink messages tend
+ * to read many small pieces of memory scattered over several pages,
+ * so every page is read from the tracee only once per event.
+ * The cache is invalidated before each event is handled, that is,
+ * after the tracee has been resumed and could have changed its memory.
+ */
+#define UMOVE_CACHE_SETS	4U
+#define UMOVE_CACHE_WAYS	4U
+
+struct umove_cache_entry {
+	unsigned long raddr;	/* address of the cached page */
+	unsigned long stamp;	/* last access, for LRU replacement */
+	unsigned int gen;	/* the entry is valid iff gen == umove_cache_gen */
+	pid_t pid;
+	char *buf;
+};
+
+static struct umove_cache_entry umove_cache[UMOVE_CACHE_SETS][UMOVE_CACHE_WAYS];
+static unsigned int umove_cache_gen = 1;
+static unsigned long umove_cache_stamp;
 
 void
 invalidate_umove_cache(void)
 {
-	cached_idx = -1;
+	if (++umove_cache_gen)
+		return;
+
+	/* Generation counter has wrapped around, reset all the entries.  */
+	for (unsigned int i = 0; i < UMOVE_CACHE_SETS; ++i)
+		for (unsigned int j = 0; j < UMOVE_CACHE_WAYS; ++j)
+			umove_cache[i][j].gen = 0;
+	umove_cache_gen = 1;
+}
+
+void
+print_umove_cache_stats(void)
+{
+	debug_msg("umove cache: %lu hits, %lu misses"
+		  ", %lu process_vm_readv calls",
+		  umove_cache_hits, umove_cache_misses,
+		  process_vm_readv_calls);
+}
+
+static const char *
+umove_cache_get_page(const pid_t pid, const unsigned long raddr_page_start,
+		     const size_t page_size)
+{
+	struct umove_cache_entry *const set =
+		umove_cache[(raddr_page_start / page_size)
+			    & (UMOVE_CACHE_SETS - 1)];
+	struct umove_cache_entry *victim = &set[0];
+
+	for (unsigned int i = 0; i < UMOVE_CACHE_WAYS; ++i) {
+		struct umove_cache_entry *const e = &set[i];
+
+		if (e->gen != umove_cache_gen) {
+			if (victim->gen == umove_cache_gen)
+				victim = e;
+			continue;
+		}
+
+		if (e->raddr == raddr_page_start && e->pid == pid) {
+			++umove_cache_hits;
+			e->stamp = ++umove_cache_stamp;
+			return e->buf;
+		}
+
+		if (victim->gen == umove_cache_gen && e->stamp < victim->stamp)
+			victim = e;
+	}
+
+	++umove_cache_misses;
+
+	if (!victim->buf)
+		victim->buf = xmalloc(page_size);
+
+	const ssize_t rc = process_read_mem(pid, victim->buf,
+					    (void *) raddr_page_start,
+					    page_size);
+	if (rc < 0) {
+		victim->gen = 0;
+		return NULL;
+	}
+
+	victim->raddr = raddr_page_start;
+	victim->pid = pid;
+	victim->gen = umove_cache_gen;
+	victim->stamp = ++umove_cache_stamp;
+
+	return victim->buf;
 }
 
+/*
+ * Copy `len' bytes of data from process `pid' at address `raddr'
+ * to our space at `laddr'.  If `nul_seen' is not NULL, look for the first
+ * NUL byte, tell whether it has been found, and if so, stop copying after
+ * it when the data is served from the cache.
+ *
+ * Returns the number of bytes copied or -1 on error; if the NUL byte has
+ * been found, the number of bytes up to and including it.
+ */
 static ssize_t
 vm_read_mem(const pid_t pid, void *const laddr,
-	    const kernel_ulong_t raddr, const size_t len)
+	    const kernel_ulong_t raddr, const size_t len,
+	    bool *const nul_seen)
 {
+	if (nul_seen)
+		*nul_seen = false;
+
 	if (!len)
 		return len;
 
@@ -94,39 +200,37 @@ vm_read_mem(const pid_t pid, void *const laddr,
 
 	if (!raddr_page_start ||
 	    raddr_page_next < raddr_page_start ||
-	    raddr_page_next - raddr_page_start != page_size)
-		return process_read_mem(pid, laddr, (void *) taddr, len);
-
-	int idx = -1;
-	if (cached_idx >= 0) {
-		if (raddr_page_start == cached_raddr[cached_idx])
-			idx = cached_idx;
-		else if (raddr_page_start == cached_raddr[!cached_idx])
-			idx = !cached_idx;
+	    raddr_page_next - raddr_page_start != page_size) {
+		const ssize_t r =
+			process_read_mem(pid, laddr, (void *) taddr, len);
+		const char *const nul =
+			nul_seen && r > 0 ? memchr(laddr, '\0', r) : NULL;
+
+		if (!nul)
+			return r;
+		*nul_seen = true;
+		return nul - (const char *) laddr + 1;
 	}
 
-	static char *buf[2];
+	const char *const buf =
+		umove_cache_get_page(pid, raddr_page_start, page_size);
+	if (!buf)
+		return -1;
 
-	if (idx == -1) {
-		idx = !cached_idx;
+	const char *const src = buf + (taddr - raddr_page_start);
+	size_t n = len;
 
-		if (!buf[idx])
-			buf[idx] = xmalloc(page_size);
+	if (nul_seen) {
+		const char *const nul = memchr(src, '\0', len);
 
-		const ssize_t rc =
-			process_read_mem(pid, buf[idx],
-					 (void *) raddr_page_start, page_size);
-		if (rc < 0)
-			return rc;
-
-		cached_raddr[idx] = raddr_page_start;
-		if (cached_idx < 0)
-			cached_raddr[!idx] = 0;
-		cached_idx = idx;
+		if (nul) {
+			*nul_seen = true;
+			n = nul - src + 1;
+		}
 	}
 
-	memcpy(laddr, buf[idx] + (taddr - cached_raddr[idx]), len);
-	return len;
+	memcpy(laddr, src, n);
+	return n;
 }
 
 static bool
@@ -207,7 +311,7 @@ umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 	if (process_vm_readv_not_supported)
 		return umoven_peekdata(pid, addr, len, our_addr);
 
-	int r = vm_read_mem(pid, our_addr, addr, len);
+	int r = vm_read_mem(pid, our_addr, addr, len, NULL);
 	if ((unsigned int) r == len)
 		return 0;
 	if (r >= 0) {
@@ -233,6 +337,75 @@ umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 	}
 }
 
+/*
+ * Copy `cnt' ranges of data described by `riov' from process `pid'
+ * to our space at `laddr', placing them one after another.
+ * As many ranges as possible are fetched using a single
+ * process_vm_readv syscall.
+ *
+ * Returns the number of leading ranges that have been copied entirely,
+ * the caller is expected to fetch the remaining ones using umoven,
+ * which takes care of the PTRACE_PEEKDATA fallback and error reporting.
+ */
+unsigned int
+umoven_iov(struct tcb *const tcp, const struct umove_iov *const riov,
+	   const unsigned int cnt, void *const laddr)
+{
+	const int pid = tcp->pid;
+	char *dst = laddr;
+	unsigned int done = 0;
+
+	while (done < cnt && !process_vm_readv_not_supported) {
+		struct iovec remote[IOV_MAX];
+		size_t total = 0;
+		unsigned int n;
+
+		for (n = 0; n < IOV_MAX && done + n < cnt; ++n) {
+			const kernel_ulong_t addr = riov[done + n].addr;
+
+			if (tracee_addr_is_invalid(addr))
+				break;
+#if SIZEOF_LONG < SIZEOF_KERNEL_LONG_T
+			if (addr != (kernel_ulong_t) (unsigned long) addr)
+				break;
+#endif
+			remote[n].iov_base = (void *) (unsigned long) addr;
+			remote[n].iov_len = riov[done + n].len;
+			total += riov[done + n].len;
+		}
+		if (!n)
+			break;
+
+		const struct iovec local = {
+			.iov_base = dst,
+			.iov_len = total
+		};
+
+		++process_vm_readv_calls;
+		const ssize_t rc =
+			process_vm_readv(pid, &local, 1, remote, n, 0);
+		if (rc < 0) {
+			if (errno == ENOSYS)
+				process_vm_readv_not_supported = true;
+			break;
+		}
+
+		/* Count the ranges that have been copied entirely.  */
+		size_t left = rc;
+		unsigned int i;
+		for (i = 0; i < n && remote[i].iov_len <= left; ++i) {
+			left -= remote[i].iov_len;
+			dst += remote[i].iov_len;
+		}
+		done += i;
+
+		if (i < n)
+			break;
+	}
+
+	return done;
+}
+
 /*
  * Like umoven_peekdata but make the additional effort of looking
  * for a terminating zero byte.
@@ -329,12 +502,11 @@ umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 		if (chunk_len > end_in_page) /* crosses to the next page */
 			chunk_len -= end_in_page;
 
-		int r = vm_read_mem(pid, laddr, addr, chunk_len);
+		bool nul_seen;
+		int r = vm_read_mem(pid, laddr, addr, chunk_len, &nul_seen);
 		if (r > 0) {
-			char *nul_addr = memchr(laddr, '\0', r);
-
-			if (nul_addr)
-				return (nul_addr - laddr) + 1;
+			if (nul_seen)
+				return r;
 			addr += r;
 			laddr += r;
 			nread += r;
@@ -0,0 +1,271 @@
+/*
+ * Frame pointer unwinder.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Code built with frame pointers keeps the frames of the functions
+ * in a chain: the frame pointer register points to the saved frame
+ * pointer of the caller, followed by the return address.  Following
+ * the chain takes a few reads of the stack and no unwinding tables,
+ * so it is much cheaper than DWARF unwinding.  The stack is read
+ * in chunks with process_vm_readv, the chain is checked to go up
+ * the stack and to return into executable mappings.
+ *
+ * If the chain is broken right away, e.g. when the tracee is stopped
+ * in code built without frame pointers, the stack is walked by the DWARF
+ * unwinder instead.  libdw and libunwind can only start unwinding
+ * from the registers of the thread, so the fallback cannot be done
+ * per frame: a chain broken further up the stack ends the stack trace,
+ * like in perf.  The program counters are resolved by the DWARF unwinder.
+ */
+
+#include "defs.h"
+#include "unwind.h"
+#include "mmap_cache.h"
+
+#define STACK_CHUNK_SIZE (16 * 1024)
+#define MAX_STACK_SIZE (512 * 1024)
+#define MAX_FRAMES 256
+
+/* The part of the stack read so far, starting at the stack pointer. */
+struct stack_window {
+	kernel_ulong_t start;
+	size_t len;
+	bool eof;
+};
+
+static char *stack_buf;
+
+static void
+init(void)
+{
+	mmap_cache_enable();
+	stack_buf = xmalloc(MAX_STACK_SIZE);
+
+	if (dwarf_unwinder.init)
+		dwarf_unwinder.init();
+}
+
+static void *
+tcb_init(struct tcb *tcp)
+{
+	return dwarf_unwinder.tcb_init(tcp);
+}
+
+static void
+tcb_fin(struct tcb *tcp)
+{
+	dwarf_unwinder.tcb_fin(tcp);
+}
+
+/*
+ * Read the next chunk of the stack.  The chunk is split at page
+ * boundaries, so that the pages below the end of the stack are read
+ * even if the chunk goes past it.
+ */
+static bool
+read_chunk(struct tcb *tcp, struct stack_window *w)
+{
+	struct umove_iov iov[STACK_CHUNK_SIZE / 4096 + 1];
+	const unsigned long page_size = get_pagesize();
+	kernel_ulong_t addr = w->start + w->len;
+	size_t left = MIN(STACK_CHUNK_SIZE, MAX_STACK_SIZE - w->len);
+	unsigned int cnt = 0;
+
+	if (w->eof || !left)
+		return false;
+
+	while (left && cnt < ARRAY_SIZE(iov)) {
+		const unsigned int len =
+			MIN(left, page_size - (addr & (page_size - 1)));
+
+		iov[cnt].addr = addr;
+		iov[cnt].len = len;
+		++cnt;
+		addr += len;
+		left -= len;
+	}
+
+	const unsigned int done = umoven_iov(tcp, iov, cnt, stack_buf + w->len);
+
+	for (unsigned int i = 0; i < done; ++i)
+		w->len += iov[i].len;
+	if (done < cnt)
+		w->eof = true;
+
+	return done;
+}
+
+static bool
+read_word(struct tcb *tcp, struct stack_window *w,
+	  const kernel_ulong_t addr, kernel_ulong_t *word)
+{
+	if (addr < w->start
+	    || addr - w->start > MAX_STACK_SIZE - sizeof(*word))
+		return false;
+
+	const size_t offset = addr - w->start;
+
+	while (offset + sizeof(*word) > w->len) {
+		if (!read_chunk(tcp, w))
+			return false;
+	}
+
+	memcpy(word, stack_buf + offset, sizeof(*word));
+	return true;
+}
+
+static bool
+is_code_address(struct tcb *tcp, const kernel_ulong_t addr)
+{
+	const struct mmap_cache_entry_t *entry = mmap_cache_search(tcp, addr);
+
+	return entry && (entry->protections & MMAP_CACHE_PROT_EXECUTABLE);
+}
+
+/* Read the saved frame pointer and the return address of a frame. */
+static bool
+read_frame(struct tcb *tcp, struct stack_window *w, const kernel_ulong_t fp,
+	   kernel_ulong_t *next_fp, kernel_ulong_t *ra)
+{
+	return !(fp & (sizeof(*next_fp) - 1))
+	       && read_word(tcp, w, fp, next_fp)
+	       && read_word(tcp, w, fp + sizeof(*next_fp), ra)
+	       && is_code_address(tcp, *ra);
+}
+
+/*
+ * The tracee is usually stopped in a syscall wrapper that does not
+ * make a frame of its own, so the return address into its caller
+ * is not in the chain.  It is taken from the link register,
+ * or from the top of the stack where the call instruction pushes it.
+ */
+static bool
+get_leaf_return_address(struct tcb *tcp, struct stack_window *w,
+			kernel_ulong_t *ra)
+{
+	if (get_link_register(tcp, ra))
+		return true;
+#if defined X86_64 || defined X32 || defined I386
+	return read_word(tcp, w, w->start, ra);
+#else
+	return false;
+#endif
+}
+
+/*
+ * Collect the program counters of the stack.  Returns the number
+ * of program counters, 0 if the frame pointer chain is broken.
+ * Like in libdw, the program counter of a caller is the address
+ * of the call instruction rather than the return address.
+ */
+static unsigned int
+walk(struct tcb *tcp, unsigned long *pcs, bool *truncated)
+{
+	const unsigned int seen_generation = tcp->mmap_cache_generation;
+	struct stack_window w = { 0 };
+	kernel_ulong_t ip, fp, next_fp, ra, leaf_ra;
+	unsigned int n = 0;
+
+	if (mmap_cache_rebuild_if_invalid(tcp, __func__)
+	    == MMAP_CACHE_REBUILD_NOCACHE)
+		return 0;
+
+	if (!get_instruction_pointer(tcp, &ip)
+	    || !get_stack_pointer(tcp, &w.start)
+	    || !get_frame_pointer(tcp, &fp)
+	    || !read_frame(tcp, &w, fp, &next_fp, &ra)) {
+		/* Let the fallback unwinder see the change of the mappings. */
+		tcp->mmap_cache_generation = seen_generation;
+		return 0;
+	}
+
+	pcs[n++] = ip;
+	if (get_leaf_return_address(tcp, &w, &leaf_ra)
+	    && leaf_ra != ra && is_code_address(tcp, leaf_ra))
+		pcs[n++] = leaf_ra - 1;
+
+	for (;;) {
+		pcs[n++] = ra - 1;
+
+		if (!next_fp)
+			break;
+		if (n >= MAX_FRAMES) {
+			*truncated = true;
+			break;
+		}
+		/* The chain has to go up the stack. */
+		if (next_fp <= fp)
+			break;
+		fp = next_fp;
+		if (!read_frame(tcp, &w, fp, &next_fp, &ra))
+			break;
+	}
+
+	return n;
+}
+
+static bool
+tcb_walk(struct tcb *tcp,
+	 unwind_call_action_fn call_action,
+	 unwind_error_action_fn error_action,
+	 void *data)
+{
+	unsigned long pcs[MAX_FRAMES];
+	bool truncated = false;
+	const unsigned int n = walk(tcp, pcs, &truncated);
+
+	if (!n)
+		return false;
+
+	for (unsigned int i = 0; i < n; ++i)
+		dwarf_unwinder.tcb_symbolize(tcp, pcs[i], call_action, data);
+	if (truncated)
+		error_action(data, "too many stack frames", 0);
+
+	return true;
+}
+
+static bool
+tcb_walk_pcs(struct tcb *tcp,
+	     unwind_pc_action_fn pc_action,
+	     unwind_error_action_fn error_action,
+	     void *data)
+{
+	unsigned long pcs[MAX_FRAMES];
+	bool truncated = false;
+	const unsigned int n = walk(tcp, pcs, &truncated);
+
+	if (!n)
+		return false;
+
+	for (unsigned int i = 0; i < n; ++i)
+		pc_action(data, pcs[i]);
+	if (truncated)
+		error_action(data, "too many stack frames", 0);
+
+	return true;
+}
+
+static void
+tcb_symbolize(struct tcb *tcp, unsigned long pc,
+	      unwind_call_action_fn call_action, void *data)
+{
+	dwarf_unwinder.tcb_symbolize(tcp, pc, call_action, data);
+}
+
+const struct unwind_unwinder_t fp_unwinder = {
+	.name = "fp",
+	.init = init,
+	.tcb_init = tcb_init,
+	.tcb_fin = tcb_fin,
+	.tcb_walk = tcb_walk,
+	.tcb_walk_pcs = tcb_walk_pcs,
+	.tcb_symbolize = tcb_symbolize,
+	.fallback = &dwarf_unwinder,
+};
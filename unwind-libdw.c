@@ -40,19 +40,30 @@ struct cache_entry {
 	unsigned long long last_use;
 };
 
+/*
+ * The context is kept per process and shared by all its threads,
+ * libdw can unwind any thread of the process it is attached to.
+ */
 struct ctx {
 	Dwfl *dwfl;
+	unsigned long long mapping_generation;
 	unsigned long long last_proc_updating;
+	int tgid;
+	unsigned int refcount;
+	struct ctx *next;
 	struct cache_entry cache[STRACE_UW_CACHE_SIZE];
 };
 
-static unsigned long long mapping_generation = 1;
+static struct ctx *contexts;
 static unsigned long long uwcache_clock;
 
 static void
-update_mapping_generation(struct tcb *tcp, void *unused)
+update_mapping_generation(struct tcb *tcp, enum mmap_notify_event event,
+			  void *unused)
 {
-	mapping_generation++;
+	struct ctx *ctx = tcp->unwind_ctx;
+	if (ctx)
+		ctx->mapping_generation++;
 }
 
 static void
@@ -64,6 +75,16 @@ init(void)
 static void *
 tcb_init(struct tcb *tcp)
 {
+	const int tgid = get_proc_tgid(tcp->pid);
+	struct ctx *ctx;
+
+	for (ctx = contexts; ctx; ctx = ctx->next) {
+		if (ctx->tgid == tgid) {
+			ctx->refcount++;
+			return ctx;
+		}
+	}
+
 	static const Dwfl_Callbacks proc_callbacks = {
 		.find_elf = dwfl_linux_proc_find_elf,
 		.find_debuginfo = dwfl_standard_find_debuginfo
@@ -75,7 +96,7 @@ tcb_init(struct tcb *tcp)
 		return NULL;
 	}
 
-	int r = dwfl_linux_proc_attach(dwfl, tcp->pid, true);
+	int r = dwfl_linux_proc_attach(dwfl, tgid, true);
 	if (r) {
 		const char *msg = NULL;
 
@@ -85,15 +106,18 @@ tcb_init(struct tcb *tcp)
 			msg = strerror(r);
 
 		error_msg("dwfl_linux_proc_attach returned an error"
-			  " for process %d: %s", tcp->pid, msg);
+			  " for process %d: %s", tgid, msg);
 		dwfl_end(dwfl);
 		return NULL;
 	}
 
-	struct ctx *ctx = xmalloc(sizeof(*ctx));
+	ctx = xzalloc(sizeof(*ctx));
 	ctx->dwfl = dwfl;
-	ctx->last_proc_updating = mapping_generation - 1;
-	memset(ctx->cache, 0, sizeof(ctx->cache));
+	ctx->mapping_generation = 1;
+	ctx->tgid = tgid;
+	ctx->refcount = 1;
+	ctx->next = contexts;
+	contexts = ctx;
 	return ctx;
 }
 
@@ -101,10 +125,17 @@ static void
 tcb_fin(struct tcb *tcp)
 {
 	struct ctx *ctx = tcp->unwind_ctx;
-	if (ctx) {
-		dwfl_end(ctx->dwfl);
-		free(ctx);
+	if (!ctx || --ctx->refcount)
+		return;
+
+	for (struct ctx **p = &contexts; *p; p = &(*p)->next) {
+		if (*p == ctx) {
+			*p = ctx->next;
+			break;
+		}
 	}
+	dwfl_end(ctx->dwfl);
+	free(ctx);
 }
 
 static void
@@ -114,9 +145,14 @@ flush_cache_maybe(struct tcb *tcp)
 	if (!ctx)
 		return;
 
-	if (ctx->last_proc_updating == mapping_generation)
+	if (ctx->last_proc_updating == ctx->mapping_generation)
 		return;
 
+	/*
+	 * The mappings are read from the tracee rather than from the thread
+	 * group leader, which has no mappings of its own after it has exited
+	 * while the other threads of the process are still running.
+	 */
 	int r = dwfl_linux_proc_report(ctx->dwfl, tcp->pid);
 
 	if (r < 0)
@@ -129,11 +165,12 @@ flush_cache_maybe(struct tcb *tcp)
 		error_msg("dwfl_report_end returned an error"
 			  " for pid %d: %s", tcp->pid, dwfl_errmsg(-1));
 
-	ctx->last_proc_updating = mapping_generation;
+	ctx->last_proc_updating = ctx->mapping_generation;
 }
 
 struct frame_user_data {
 	unwind_call_action_fn call_action;
+	unwind_pc_action_fn pc_action;
 	unwind_error_action_fn error_action;
 	void *data;
 	int stack_depth;
@@ -148,12 +185,12 @@ find_bucket(struct ctx *ctx, Dwarf_Addr pc, struct cache_entry **res) {
 	struct cache_entry *lru = ctx->cache + idx;
 	for (unsigned int i = 0; i < STRACE_UW_CACHE_ASSOC; ++i) {
 		struct cache_entry *ce = ctx->cache + (idx + i);
-		if (ce->generation == mapping_generation && ce->pc == pc) {
+		if (ce->generation == ctx->mapping_generation && ce->pc == pc) {
 			ce->last_use = uwcache_clock++;
 			*res = ce;
 			return true;
 		}
-		if (ce->generation != mapping_generation) {
+		if (ce->generation != ctx->mapping_generation) {
 			unused = ce;
 			continue;
 		}
@@ -165,6 +202,84 @@ find_bucket(struct ctx *ctx, Dwarf_Addr pc, struct cache_entry **res) {
 	return false;
 }
 
+/*
+ * The object file of the module in the symbol cache is kept
+ * in the user data of the module.
+ */
+static struct unwind_object *
+get_object(Dwfl_Module *mod, void **userdata, const char *modname)
+{
+	if (!*userdata) {
+		const unsigned char *build_id;
+		GElf_Addr vaddr;
+		Dwarf_Addr bias;
+		int len = 0;
+
+		/* The build-id is found when the module is loaded.  */
+		if (dwfl_module_getelf(mod, &bias))
+			len = dwfl_module_build_id(mod, &build_id, &vaddr);
+		if (len > 0)
+			*userdata = unwind_object_by_build_id(build_id, len);
+		else if (modname && modname[0] == '/')
+			*userdata = unwind_object_by_file(modname, 0, 0);
+	}
+
+	return *userdata;
+}
+
+static void
+symbolize(struct ctx *ctx, Dwarf_Addr pc,
+	  unwind_call_action_fn call_action, void *data)
+{
+	struct cache_entry *ce;
+	if (find_bucket(ctx, pc, &ce)) {
+		call_action(data, ce->modname, ce->symname,
+			    ce->off, ce->true_offset);
+		return;
+	}
+
+	Dwfl_Module *mod = dwfl_addrmodule(ctx->dwfl, pc);
+	GElf_Off off = 0;
+
+	if (mod == NULL)
+		return;
+
+	const char *modname = NULL;
+	const char *symname = NULL;
+	void **userdata;
+	Dwarf_Addr start;
+	GElf_Sym sym;
+	Dwarf_Addr true_offset = pc;
+
+	modname = dwfl_module_info(mod, &userdata, &start, NULL,
+				   NULL, NULL, NULL, NULL);
+
+	struct unwind_object *obj = get_object(mod, userdata, modname);
+	const struct unwind_symbol *cached =
+		obj ? unwind_symbol_lookup(obj, pc - start) : NULL;
+
+	if (cached) {
+		symname = cached->name;
+		off = cached->function_offset;
+	} else {
+		symname = dwfl_module_addrinfo(mod, pc, &off, &sym,
+					       NULL, NULL, NULL);
+		if (obj)
+			symname = unwind_symbol_add(obj, pc - start,
+						    symname, off)->name;
+	}
+	dwfl_module_relocate_address(mod, &true_offset);
+	call_action(data, modname, symname, off, true_offset);
+
+	ce->generation = ctx->mapping_generation;
+	ce->pc = pc;
+	ce->modname = modname;
+	ce->symname = symname;
+	ce->off = off;
+	ce->true_offset = true_offset;
+	ce->last_use = uwcache_clock++;
+}
+
 static int
 frame_callback(Dwfl_Frame *state, void *arg)
 {
@@ -180,39 +295,11 @@ frame_callback(Dwfl_Frame *state, void *arg)
 	if (!isactivation)
 		pc--;
 
-	struct cache_entry *ce;
-	if (find_bucket(user_data->ctx, pc, &ce)) {
-		user_data->call_action(user_data->data,
-				       ce->modname, ce->symname,
-			               ce->off, ce->true_offset);
-	} else {
-		Dwfl *dwfl = dwfl_thread_dwfl(dwfl_frame_thread(state));
-		Dwfl_Module *mod = dwfl_addrmodule(dwfl, pc);
-		GElf_Off off = 0;
-
-		if (mod != NULL) {
-			const char *modname = NULL;
-			const char *symname = NULL;
-			GElf_Sym sym;
-			Dwarf_Addr true_offset = pc;
-
-			modname = dwfl_module_info(mod, NULL, NULL, NULL, NULL,
-						   NULL, NULL, NULL);
-			symname = dwfl_module_addrinfo(mod, pc, &off, &sym,
-						       NULL, NULL, NULL);
-			dwfl_module_relocate_address(mod, &true_offset);
-			user_data->call_action(user_data->data, modname, symname,
-					       off, true_offset);
-
-			ce->generation = mapping_generation;
-			ce->pc = pc;
-			ce->modname = modname;
-			ce->symname = symname;
-			ce->off = off;
-			ce->true_offset = true_offset;
-			ce->last_use = uwcache_clock++;
-		}
-	}
+	if (user_data->pc_action)
+		user_data->pc_action(user_data->data, pc);
+	else
+		symbolize(user_data->ctx, pc, user_data->call_action,
+			  user_data->data);
 
 	/* Max number of frames to print reached? */
 	if (user_data->stack_depth-- == 0)
@@ -222,37 +309,85 @@ frame_callback(Dwfl_Frame *state, void *arg)
 }
 
 static void
-tcb_walk(struct tcb *tcp,
-	 unwind_call_action_fn call_action,
-	 unwind_error_action_fn error_action,
-	 void *data)
+walk(struct tcb *tcp, struct frame_user_data *user_data)
 {
 	struct ctx *ctx = tcp->unwind_ctx;
 	if (!ctx)
 		return;
 
+	user_data->stack_depth = 256;
+	user_data->ctx = ctx;
+
+	flush_cache_maybe(tcp);
+
+	int r = dwfl_getthread_frames(ctx->dwfl, tcp->pid, frame_callback,
+				      user_data);
+	if (r)
+		user_data->error_action(user_data->data,
+					r < 0 ? dwfl_errmsg(-1)
+					      : "too many stack frames",
+					0);
+}
+
+static bool
+tcb_walk(struct tcb *tcp,
+	 unwind_call_action_fn call_action,
+	 unwind_error_action_fn error_action,
+	 void *data)
+{
 	struct frame_user_data user_data = {
 		.call_action = call_action,
 		.error_action = error_action,
 		.data = data,
-		.stack_depth = 256,
-		.ctx = ctx,
 	};
 
-	flush_cache_maybe(tcp);
+	walk(tcp, &user_data);
+	return true;
+}
 
-	int r = dwfl_getthread_frames(ctx->dwfl, tcp->pid, frame_callback,
-				      &user_data);
-	if (r)
-		error_action(data,
-			     r < 0 ? dwfl_errmsg(-1) : "too many stack frames",
-			     0);
+/*
+ * The program counters are resolved against the modules reported
+ * when the stack was walked: the modules are not reported again
+ * until the next walk.
+ */
+static bool
+tcb_walk_pcs(struct tcb *tcp,
+	     unwind_pc_action_fn pc_action,
+	     unwind_error_action_fn error_action,
+	     void *data)
+{
+	struct frame_user_data user_data = {
+		.pc_action = pc_action,
+		.error_action = error_action,
+		.data = data,
+	};
+
+	walk(tcp, &user_data);
+	return true;
+}
+
+/*
+ * The stack could have been walked by another unwinder,
+ * make sure the modules are reported.
+ */
+static void
+tcb_symbolize(struct tcb *tcp, unsigned long pc,
+	      unwind_call_action_fn call_action, void *data)
+{
+	struct ctx *ctx = tcp->unwind_ctx;
+	if (!ctx)
+		return;
+
+	flush_cache_maybe(tcp);
+	symbolize(ctx, pc, call_action, data);
 }
 
-const struct unwind_unwinder_t unwinder = {
+const struct unwind_unwinder_t dwarf_unwinder = {
 	.name = "libdw",
 	.init = init,
 	.tcb_init = tcb_init,
 	.tcb_fin = tcb_fin,
 	.tcb_walk = tcb_walk,
+	.tcb_walk_pcs = tcb_walk_pcs,
+	.tcb_symbolize = tcb_symbolize,
 };
@@ -9,6 +9,7 @@
 #include "unwind.h"
 
 #include "mmap_cache.h"
+#include <sys/sysmacros.h>
 #include <libunwind-ptrace.h>
 
 static unw_addr_space_t libunwind_as;
@@ -59,6 +60,18 @@ get_symbol_name(unw_cursor_t *cursor, char **name,
 	}
 }
 
+static struct unwind_object *
+get_object(struct mmap_cache_entry_t *entry)
+{
+	if (!entry->object && entry->binary_filename[0] == '/')
+		entry->object =
+			unwind_object_by_file(entry->binary_filename,
+					      makedev(entry->major,
+						      entry->minor),
+					      entry->inode);
+	return entry->object;
+}
+
 static int
 print_stack_frame(struct tcb *tcp,
 		  unwind_call_action_fn call_action,
@@ -80,12 +93,28 @@ print_stack_frame(struct tcb *tcp,
 	if (entry
 	    /* ignore mappings that have no PROT_EXEC bit set */
 	    && (entry->protections & MMAP_CACHE_PROT_EXECUTABLE)) {
+		unsigned long true_offset =
+			ip - entry->start_addr + entry->mmap_offset;
+		struct unwind_object *obj = get_object(entry);
+		const struct unwind_symbol *sym =
+			obj ? unwind_symbol_lookup(obj, true_offset) : NULL;
+
+		if (sym) {
+			call_action(data,
+				    entry->binary_filename,
+				    sym->name,
+				    sym->function_offset,
+				    true_offset);
+			return 0;
+		}
+
 		unw_word_t function_offset;
 
 		get_symbol_name(cursor, symbol_name, symbol_name_size,
 				&function_offset);
-		unsigned long true_offset =
-			ip - entry->start_addr + entry->mmap_offset;
+		if (obj)
+			unwind_symbol_add(obj, true_offset, *symbol_name,
+					  function_offset);
 		call_action(data,
 			    entry->binary_filename,
 			    *symbol_name,
@@ -137,7 +166,7 @@ walk(struct tcb *tcp,
 	free(symbol_name);
 }
 
-static void
+static bool
 tcb_walk(struct tcb *tcp,
 	 unwind_call_action_fn call_action,
 	 unwind_error_action_fn error_action,
@@ -159,12 +188,68 @@ tcb_walk(struct tcb *tcp,
 			/* Do nothing */
 			;
 	}
+
+	return true;
+}
+
+/*
+ * The program counters of a stack walked by another unwinder
+ * are resolved without a cursor, with the get_proc_name accessor.
+ */
+static void
+tcb_symbolize(struct tcb *tcp, unsigned long pc,
+	      unwind_call_action_fn call_action, void *data)
+{
+	struct mmap_cache_entry_t *entry = mmap_cache_search(tcp, pc);
+
+	if (!entry || !(entry->protections & MMAP_CACHE_PROT_EXECUTABLE))
+		return;
+
+	unsigned long true_offset =
+		pc - entry->start_addr + entry->mmap_offset;
+	struct unwind_object *obj = get_object(entry);
+	const struct unwind_symbol *sym =
+		obj ? unwind_symbol_lookup(obj, true_offset) : NULL;
+
+	if (sym) {
+		call_action(data, entry->binary_filename,
+			    sym->name, sym->function_offset, true_offset);
+		return;
+	}
+
+	unw_accessors_t *a = unw_get_accessors(libunwind_as);
+	size_t symbol_name_size = 40;
+	char *symbol_name = xmalloc(symbol_name_size);
+	unw_word_t function_offset;
+
+	for (;;) {
+		int rc = a->get_proc_name(libunwind_as, pc, symbol_name,
+					  symbol_name_size, &function_offset,
+					  tcp->unwind_ctx);
+
+		if (rc == 0)
+			break;
+		if (rc != -UNW_ENOMEM) {
+			symbol_name[0] = '\0';
+			function_offset = 0;
+			break;
+		}
+		symbol_name = xgrowarray(symbol_name, &symbol_name_size, 1);
+	}
+
+	if (obj)
+		unwind_symbol_add(obj, true_offset, symbol_name,
+				  function_offset);
+	call_action(data, entry->binary_filename,
+		    symbol_name, function_offset, true_offset);
+	free(symbol_name);
 }
 
-const struct unwind_unwinder_t unwinder = {
+const struct unwind_unwinder_t dwarf_unwinder = {
 	.name = "libunwind",
 	.init = init,
 	.tcb_init = tcb_init,
 	.tcb_fin = tcb_fin,
 	.tcb_walk = tcb_walk,
+	.tcb_symbolize = tcb_symbolize,
 };
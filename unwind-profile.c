@@ -0,0 +1,211 @@
+/*
+ * Stack profile: syscalls counted by stack trace.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Instead of printing the stack trace of every syscall, syscalls are
+ * counted per unique pair of the syscall and its stack trace.  Frames
+ * are interned, so that a stack trace is an array of frame numbers,
+ * and the stack traces are interned in turn; both are kept in arrays
+ * with index tables.  On exit, the counts are written in the
+ * folded stack format understood by flame graph tools: the frames
+ * from the outermost one and the syscall name, separated by semicolons,
+ * followed by the number of syscalls or their total time in microseconds.
+ */
+
+#include "defs.h"
+#include "index_table.h"
+#include "unwind.h"
+
+#ifdef USE_DEMANGLE
+# if defined HAVE_DEMANGLE_H
+#  include <demangle.h>
+# elif defined HAVE_LIBIBERTY_DEMANGLE_H
+#  include <libiberty/demangle.h>
+# endif
+#endif
+
+struct profile_frame {
+	char *name;
+};
+
+struct profile_stack {
+	const char *syscall;
+	unsigned int *frames;
+	unsigned int nframes;
+	unsigned long long count;
+	unsigned long long time_ns;
+};
+
+struct profile_stack_key {
+	const char *syscall;
+	const unsigned int *frames;
+	unsigned int nframes;
+};
+
+static struct profile_frame *frames;
+static size_t frames_size;
+static size_t frames_used;
+static struct index_table frame_index;
+
+static struct profile_stack *stacks;
+static size_t stacks_size;
+static size_t stacks_used;
+static struct index_table stack_index;
+
+static bool
+frame_matches(const unsigned int num, const void *name)
+{
+	return !strcmp(frames[num].name, name);
+}
+
+unsigned int
+unwind_profile_frame(const char *binary_filename, const char *symbol_name,
+		     const unsigned long true_offset)
+{
+	char buf[PATH_MAX + sizeof("+0x") + sizeof(long) * 2];
+	const char *name = symbol_name;
+
+	/* Frames without a symbol are told apart by their address. */
+	if (!name || !*name) {
+		snprintf(buf, sizeof(buf), "%s+0x%lx",
+			 binary_filename ? binary_filename : "[unknown]",
+			 true_offset);
+		name = buf;
+	}
+
+	const uint32_t hash = hash_string(HASH_INIT, name);
+	unsigned int num = index_table_lookup(&frame_index, hash,
+					      frame_matches, name);
+
+	if (num == INDEX_TABLE_NONE) {
+		if (frames_used >= frames_size)
+			frames = xgrowarray(frames, &frames_size,
+					    sizeof(*frames));
+		frames[frames_used].name = xstrdup(name);
+		num = frames_used++;
+		index_table_add(&frame_index, hash, num);
+	}
+
+	return num;
+}
+
+static bool
+stack_matches(const unsigned int num, const void *key)
+{
+	const struct profile_stack *s = &stacks[num];
+	const struct profile_stack_key *k = key;
+
+	return s->nframes == k->nframes
+	       && strcmp(s->syscall, k->syscall) == 0
+	       && memcmp(s->frames, k->frames,
+			 k->nframes * sizeof(*k->frames)) == 0;
+}
+
+void
+unwind_profile_add(const char *syscall, const unsigned int *frame_nums,
+		   const unsigned int nframes,
+		   const unsigned long long time_ns)
+{
+	const struct profile_stack_key key = {
+		.syscall = syscall,
+		.frames = frame_nums,
+		.nframes = nframes,
+	};
+	const uint32_t hash =
+		hash_bytes(hash_string(HASH_INIT, syscall),
+			   frame_nums, nframes * sizeof(*frame_nums));
+	unsigned int num = index_table_lookup(&stack_index, hash,
+					      stack_matches, &key);
+
+	if (num == INDEX_TABLE_NONE) {
+		if (stacks_used >= stacks_size)
+			stacks = xgrowarray(stacks, &stacks_size,
+					    sizeof(*stacks));
+
+		struct profile_stack *const s = &stacks[stacks_used];
+
+		*s = (struct profile_stack) {
+			.syscall = syscall,
+			.frames = xcalloc(nframes ? nframes : 1,
+					  sizeof(*s->frames)),
+			.nframes = nframes,
+		};
+		memcpy(s->frames, frame_nums, nframes * sizeof(*frame_nums));
+		num = stacks_used++;
+		index_table_add(&stack_index, hash, num);
+	}
+
+	++stacks[num].count;
+	stacks[num].time_ns += time_ns;
+}
+
+static bool by_time;
+
+static unsigned long long
+stack_weight(const struct profile_stack *s)
+{
+	return by_time ? (s->time_ns + 500) / 1000 : s->count;
+}
+
+static int
+stack_cmp(const void *a, const void *b)
+{
+	const unsigned long long wa =
+		stack_weight(*(const struct profile_stack *const *) a);
+	const unsigned long long wb =
+		stack_weight(*(const struct profile_stack *const *) b);
+
+	return (wa < wb) - (wa > wb);
+}
+
+static void
+print_frame(FILE *fp, const char *name)
+{
+#ifdef USE_DEMANGLE
+	char *demangled_name = cplus_demangle(name, DMGL_AUTO | DMGL_PARAMS);
+
+	if (demangled_name) {
+		fputs(demangled_name, fp);
+		free(demangled_name);
+		return;
+	}
+#endif
+	fputs(name, fp);
+}
+
+void
+unwind_profile_print(FILE *fp, const bool weight_by_time)
+{
+	struct profile_stack **sorted;
+	const size_t n = stacks_used;
+
+	if (!n)
+		return;
+
+	sorted = xcalloc(n, sizeof(*sorted));
+	for (size_t i = 0; i < n; ++i)
+		sorted[i] = &stacks[i];
+
+	by_time = weight_by_time;
+	qsort(sorted, n, sizeof(*sorted), stack_cmp);
+
+	for (size_t i = 0; i < n; ++i) {
+		const struct profile_stack *s = sorted[i];
+
+		for (unsigned int j = 0; j < s->nframes; ++j) {
+			print_frame(fp, frames[s->frames[j]].name);
+			fputc(';', fp);
+		}
+		fprintf(fp, "%s %llu\n", s->syscall, stack_weight(s));
+	}
+
+	free(sorted);
+	debug_msg("stack profile: %zu stack traces of %zu frames",
+		  stacks_used, frames_used);
+}
@@ -0,0 +1,180 @@
+/*
+ * Symbol cache shared by all tracees.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Symbols are cached per object file rather than per tracee, so that
+ * an object file mapped by many processes, like libc or the dynamic
+ * loader, is symbolized once per strace run.  Object files are told
+ * apart by their build-id, if the unwinder knows it, or by the device,
+ * inode and modification time of the file.  Symbols are indexed
+ * by the object file and the offset of the address within it.
+ * Nothing is ever evicted:
+ * the number of distinct addresses in stack traces is small.
+ */
+
+#include "defs.h"
+#include <sys/stat.h>
+#include "index_table.h"
+#include "largefile_wrappers.h"
+#include "unwind.h"
+
+struct unwind_object {
+	unsigned char *build_id;
+	size_t build_id_len;
+	dev_t dev;
+	unsigned long ino;
+	time_t mtime;
+	struct unwind_object *next;
+};
+
+struct symbol_entry {
+	const struct unwind_object *object;
+	unsigned long offset;
+	struct unwind_symbol symbol;
+};
+
+static struct unwind_object *objects;
+static struct symbol_entry *symbols;
+static size_t symbols_size;
+static size_t symbols_used;
+static struct index_table symbol_index;
+
+static struct {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned int objects;
+} stats;
+
+struct unwind_object *
+unwind_object_by_build_id(const void *const build_id, const size_t len)
+{
+	struct unwind_object *obj;
+
+	for (obj = objects; obj; obj = obj->next) {
+		if (obj->build_id_len == len
+		    && memcmp(obj->build_id, build_id, len) == 0)
+			return obj;
+	}
+
+	obj = xzalloc(sizeof(*obj));
+	obj->build_id = xmalloc(len);
+	memcpy(obj->build_id, build_id, len);
+	obj->build_id_len = len;
+	obj->next = objects;
+	objects = obj;
+	++stats.objects;
+
+	return obj;
+}
+
+struct unwind_object *
+unwind_object_by_file(const char *const filename, const dev_t dev,
+		      const unsigned long ino)
+{
+	strace_stat_t st;
+	struct unwind_object *obj;
+
+	if (stat_file(filename, &st))
+		return NULL;
+	/*
+	 * The file could have been replaced since it was mapped,
+	 * or be another file in the mount namespace of strace.
+	 */
+	if (ino && (st.st_dev != dev || st.st_ino != ino))
+		return NULL;
+
+	for (obj = objects; obj; obj = obj->next) {
+		if (!obj->build_id_len
+		    && obj->dev == st.st_dev
+		    && obj->ino == st.st_ino
+		    && obj->mtime == st.st_mtime)
+			return obj;
+	}
+
+	obj = xzalloc(sizeof(*obj));
+	obj->dev = st.st_dev;
+	obj->ino = st.st_ino;
+	obj->mtime = st.st_mtime;
+	obj->next = objects;
+	objects = obj;
+	++stats.objects;
+
+	return obj;
+}
+
+static uint32_t
+symbol_hash(const struct unwind_object *const obj, const unsigned long offset)
+{
+	return hash_bytes(hash_bytes(HASH_INIT, &obj, sizeof(obj)),
+			  &offset, sizeof(offset));
+}
+
+static bool
+symbol_matches(const unsigned int num, const void *key)
+{
+	const struct symbol_entry *e = &symbols[num];
+	const struct symbol_entry *k = key;
+
+	return e->object == k->object && e->offset == k->offset;
+}
+
+const struct unwind_symbol *
+unwind_symbol_lookup(const struct unwind_object *const obj,
+		     const unsigned long offset)
+{
+	const struct symbol_entry key = { .object = obj, .offset = offset };
+	const unsigned int num =
+		index_table_lookup(&symbol_index, symbol_hash(obj, offset),
+				   symbol_matches, &key);
+
+	if (num != INDEX_TABLE_NONE) {
+		++stats.hits;
+		return &symbols[num].symbol;
+	}
+
+	++stats.misses;
+	return NULL;
+}
+
+const struct unwind_symbol *
+unwind_symbol_add(const struct unwind_object *const obj,
+		  const unsigned long offset, const char *const name,
+		  const unwind_function_offset_t function_offset)
+{
+	const struct symbol_entry key = { .object = obj, .offset = offset };
+	const uint32_t hash = symbol_hash(obj, offset);
+	unsigned int num = index_table_lookup(&symbol_index, hash,
+					      symbol_matches, &key);
+
+	if (num == INDEX_TABLE_NONE) {
+		if (symbols_used >= symbols_size)
+			symbols = xgrowarray(symbols, &symbols_size,
+					     sizeof(*symbols));
+		symbols[symbols_used] = (struct symbol_entry) {
+			.object = obj,
+			.offset = offset,
+			.symbol = {
+				.name = xstrdup(name),
+				.function_offset = function_offset,
+			},
+		};
+		num = symbols_used++;
+		index_table_add(&symbol_index, hash, num);
+	}
+
+	return &symbols[num].symbol;
+}
+
+void
+unwind_symbols_print_stats(void)
+{
+	debug_msg("symbol cache: %llu hits, %llu misses"
+		  ", %zu symbols of %u object files",
+		  stats.hits, stats.misses, symbols_used, stats.objects);
+}
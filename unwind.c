@@ -17,27 +17,78 @@
 #endif
 
 /*
- * Type used in stacktrace capturing
+ * Stack traces are kept in the queue as raw frames until they are printed,
+ * so that neither formatting nor demangling is done while the tracee
+ * is stopped.  A stack trace captured on entering a syscall is resolved
+ * right away: the mappings it refers to may be gone when it is printed,
+ * e.g. after execve.  A stack trace printed on exiting a syscall
+ * or on a signal is walked without resolving symbols if the unwinder
+ * can do that; the symbols are resolved when the output is flushed
+ * after the tracee is restarted.
  */
-struct call_t {
-	struct call_t *next;
-	char *output_line;
+enum frame_kind {
+	FRAME_CALL,
+	FRAME_ERROR,
+	FRAME_PC,	/* Symbol is to be resolved by the unwinder. */
+};
+
+#define NO_STRING ((size_t) -1)
+
+struct frame_t {
+	enum frame_kind kind;
+	/* The program counter for FRAME_PC frames. */
+	unsigned long true_offset;
+	unwind_function_offset_t function_offset;
+	/* Offsets in the string pool of the queue, or NO_STRING. */
+	size_t binary_filename;
+	size_t symbol_name;	/* The error message for FRAME_ERROR frames. */
 };
 
 struct unwind_queue_t {
-	struct call_t *tail;
-	struct call_t *head;
+	struct frame_t *frames;
+	size_t nframes;
+	size_t frames_size;
+	char *strings;
+	size_t strings_len;
+	size_t strings_size;
+	/* Whether the frames have been captured on entering a syscall. */
+	bool captured;
+	/* Whether the frames are to be printed when the output is flushed. */
+	bool print_pending;
 };
 
-static void queue_print(struct unwind_queue_t *queue);
+/* Numbers of stacks walked by the selected unwinder and by its fallbacks. */
+static unsigned long long walks, fallback_walks;
+
+static void queue_print(struct tcb *tcp, struct unwind_queue_t *queue);
+static void queue_profile(struct tcb *tcp, struct unwind_queue_t *queue,
+			  unsigned long long time_ns);
 
-static const char asprintf_error_str[] = "???";
+const struct unwind_unwinder_t *unwinder = &dwarf_unwinder;
+
+bool
+unwind_set_unwinder(const char *name)
+{
+	static const struct unwind_unwinder_t *const unwinders[] = {
+		&dwarf_unwinder,
+		&fp_unwinder,
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(unwinders); ++i) {
+		if (strcmp(name, unwinders[i]->name) == 0) {
+			unwinder = unwinders[i];
+			return true;
+		}
+	}
+
+	return false;
+}
 
 void
 unwind_init(void)
 {
-	if (unwinder.init)
-		unwinder.init();
+	if (unwinder->init)
+		unwinder->init();
 }
 
 void
@@ -46,11 +97,9 @@ unwind_tcb_init(struct tcb *tcp)
 	if (tcp->unwind_queue)
 		return;
 
-	tcp->unwind_queue = xmalloc(sizeof(*tcp->unwind_queue));
-	tcp->unwind_queue->head = NULL;
-	tcp->unwind_queue->tail = NULL;
+	tcp->unwind_queue = xzalloc(sizeof(*tcp->unwind_queue));
 
-	tcp->unwind_ctx = unwinder.tcb_init(tcp);
+	tcp->unwind_ctx = unwinder->tcb_init(tcp);
 }
 
 void
@@ -59,11 +108,17 @@ unwind_tcb_fin(struct tcb *tcp)
 	if (!tcp->unwind_queue)
 		return;
 
-	queue_print(tcp->unwind_queue);
+	/* A stack trace captured on entering exit_group, for instance.  */
+	if (stack_profile_enabled)
+		queue_profile(tcp, tcp->unwind_queue, 0);
+	else
+		queue_print(tcp, tcp->unwind_queue);
+	free(tcp->unwind_queue->frames);
+	free(tcp->unwind_queue->strings);
 	free(tcp->unwind_queue);
 	tcp->unwind_queue = NULL;
 
-	unwinder.tcb_fin(tcp);
+	unwinder->tcb_fin(tcp);
 	tcp->unwind_ctx = NULL;
 }
 
@@ -121,8 +176,23 @@ print_call_cb(void *dummy,
 		tprintf(STACK_ENTRY_NOSYMBOL_FMT);
 	else
 		tprintf(STACK_ENTRY_BUG_FMT, __func__);
+}
 
-	line_ended();
+/*
+ * Captured stack traces have always printed frames with an empty
+ * symbol name as "(+offset)", keep it that way.
+ */
+static void
+print_captured_call(const char *binary_filename,
+		    const char *symbol_name,
+		    unwind_function_offset_t function_offset,
+		    unsigned long true_offset)
+{
+	if (symbol_name && symbol_name[0] == '\0')
+		tprintf(STACK_ENTRY_SYMBOL_FMT(symbol_name));
+	else
+		print_call_cb(NULL, binary_filename, symbol_name,
+			      function_offset, true_offset);
 }
 
 static void
@@ -134,81 +204,54 @@ print_error_cb(void *dummy,
 		tprintf(STACK_ENTRY_ERROR_WITH_OFFSET_FMT);
 	else
 		tprintf(STACK_ENTRY_ERROR_FMT);
-
-	line_ended();
 }
 
-static char *
-sprint_call_or_error(const char *binary_filename,
-		     const char *symbol_name,
-		     unwind_function_offset_t function_offset,
-		     unsigned long true_offset,
-		     const char *error)
+/*
+ * queue manipulators
+ */
+static size_t
+queue_put_string(struct unwind_queue_t *queue, const char *str)
 {
-	char *output_line = NULL;
-	int n;
+	if (!str)
+		return NO_STRING;
 
-	if (symbol_name) {
-#ifdef USE_DEMANGLE
-		char *demangled_name =
-			cplus_demangle(symbol_name,
-				       DMGL_AUTO | DMGL_PARAMS);
-#endif
-		n = asprintf(&output_line,
-			     STACK_ENTRY_SYMBOL_FMT(
-#ifdef USE_DEMANGLE
-						    demangled_name ? demangled_name :
-#endif
-						    symbol_name));
-#ifdef USE_DEMANGLE
-		free(demangled_name);
-#endif
-	}
-	else if (binary_filename)
-		n = asprintf(&output_line, STACK_ENTRY_NOSYMBOL_FMT);
-	else if (error)
-		n = true_offset
-			? asprintf(&output_line, STACK_ENTRY_ERROR_WITH_OFFSET_FMT)
-			: asprintf(&output_line, STACK_ENTRY_ERROR_FMT);
-	else
-		n = asprintf(&output_line, STACK_ENTRY_BUG_FMT, __func__);
+	const size_t offset = queue->strings_len;
+	const size_t len = strlen(str) + 1;
 
-	if (n < 0) {
-		perror_func_msg("asprintf");
-		output_line = (char *) asprintf_error_str;
-	}
+	while (queue->strings_size - queue->strings_len < len)
+		queue->strings = xgrowarray(queue->strings,
+					    &queue->strings_size, 1);
+	memcpy(queue->strings + offset, str, len);
+	queue->strings_len += len;
 
-	return output_line;
+	return offset;
+}
+
+static const char *
+queue_get_string(const struct unwind_queue_t *queue, size_t offset)
+{
+	return offset == NO_STRING ? NULL : queue->strings + offset;
 }
 
-/*
- * queue manipulators
- */
 static void
 queue_put(struct unwind_queue_t *queue,
+	  enum frame_kind kind,
 	  const char *binary_filename,
 	  const char *symbol_name,
 	  unwind_function_offset_t function_offset,
-	  unsigned long true_offset,
-	  const char *error)
+	  unsigned long true_offset)
 {
-	struct call_t *call;
-
-	call = xmalloc(sizeof(*call));
-	call->output_line = sprint_call_or_error(binary_filename,
-						 symbol_name,
-						 function_offset,
-						 true_offset,
-						 error);
-	call->next = NULL;
-
-	if (!queue->head) {
-		queue->head = call;
-		queue->tail = call;
-	} else {
-		queue->tail->next = call;
-		queue->tail = call;
-	}
+	if (queue->nframes >= queue->frames_size)
+		queue->frames = xgrowarray(queue->frames, &queue->frames_size,
+					   sizeof(*queue->frames));
+
+	struct frame_t *frame = &queue->frames[queue->nframes++];
+
+	frame->kind = kind;
+	frame->true_offset = true_offset;
+	frame->function_offset = function_offset;
+	frame->binary_filename = queue_put_string(queue, binary_filename);
+	frame->symbol_name = queue_put_string(queue, symbol_name);
 }
 
 static void
@@ -219,11 +262,11 @@ queue_put_call(void *queue,
 	       unsigned long true_offset)
 {
 	queue_put(queue,
+		  FRAME_CALL,
 		  binary_filename,
 		  symbol_name,
 		  function_offset,
-		  true_offset,
-		  NULL);
+		  true_offset);
 }
 
 static void
@@ -231,33 +274,129 @@ queue_put_error(void *queue,
 		const char *error,
 		unsigned long ip)
 {
-	queue_put(queue, NULL, NULL, 0, ip, error);
+	queue_put(queue, FRAME_ERROR, NULL, error, 0, ip);
 }
 
 static void
-queue_print(struct unwind_queue_t *queue)
+queue_put_pc(void *queue,
+	     unsigned long pc)
 {
-	struct call_t *call, *tmp;
+	queue_put(queue, FRAME_PC, NULL, NULL, 0, pc);
+}
 
-	queue->tail = NULL;
-	call = queue->head;
-	queue->head = NULL;
-	while (call) {
-		tmp = call;
-		call = call->next;
+static void
+queue_print(struct tcb *tcp, struct unwind_queue_t *queue)
+{
+	for (size_t i = 0; i < queue->nframes; ++i) {
+		const struct frame_t *frame = &queue->frames[i];
+		const char *binary_filename =
+			queue_get_string(queue, frame->binary_filename);
+		const char *symbol_name =
+			queue_get_string(queue, frame->symbol_name);
+
+		switch (frame->kind) {
+		case FRAME_CALL:
+			if (queue->captured)
+				print_captured_call(binary_filename,
+						    symbol_name,
+						    frame->function_offset,
+						    frame->true_offset);
+			else
+				print_call_cb(NULL, binary_filename,
+					      symbol_name,
+					      frame->function_offset,
+					      frame->true_offset);
+			break;
+		case FRAME_ERROR:
+			print_error_cb(NULL, symbol_name, frame->true_offset);
+			break;
+		case FRAME_PC:
+			unwinder->tcb_symbolize(tcp, frame->true_offset,
+						print_call_cb, NULL);
+			break;
+		}
+	}
+
+	if (queue->nframes)
+		tcp->curcol = 0;
 
-		tprints(tmp->output_line);
-		line_ended();
+	queue->nframes = 0;
+	queue->strings_len = 0;
+	queue->captured = false;
+	queue->print_pending = false;
+}
 
-		if (tmp->output_line != asprintf_error_str)
-			free(tmp->output_line);
+/* Count the syscall of the tracee with the stack trace in the queue.  */
+static void
+queue_profile(struct tcb *tcp, struct unwind_queue_t *queue,
+	      unsigned long long time_ns)
+{
+	static unsigned int *frame_nums;
+	static size_t frame_nums_size;
+	unsigned int n = 0;
 
-		tmp->output_line = NULL;
-		tmp->next = NULL;
-		free(tmp);
+	if (!queue->nframes)
+		return;
+
+	while (frame_nums_size < queue->nframes)
+		frame_nums = xgrowarray(frame_nums, &frame_nums_size,
+					sizeof(*frame_nums));
+
+	/* Folded stacks start with the outermost frame.  */
+	for (size_t i = queue->nframes; i > 0; --i) {
+		const struct frame_t *frame = &queue->frames[i - 1];
+
+		if (frame->kind != FRAME_CALL)
+			continue;
+		frame_nums[n++] = unwind_profile_frame(
+			queue_get_string(queue, frame->binary_filename),
+			queue_get_string(queue, frame->symbol_name),
+			frame->true_offset);
+	}
+
+	unwind_profile_add(tcp_sysent(tcp)->sys_name, frame_nums, n, time_ns);
+
+	queue->nframes = 0;
+	queue->strings_len = 0;
+	queue->captured = false;
+}
+
+/*
+ * Walk the stack with the selected unwinder, or with its fallback
+ * if it cannot.  Unless the symbols are to be resolved right away,
+ * only the program counters are taken if the unwinder can do that.
+ */
+static void
+queue_walk(struct tcb *tcp, struct unwind_queue_t *queue, bool resolve)
+{
+	for (const struct unwind_unwinder_t *u = unwinder; u;
+	     u = u->fallback) {
+		bool walked;
+
+		if (!resolve && u->tcb_walk_pcs && unwinder->tcb_symbolize)
+			walked = u->tcb_walk_pcs(tcp, queue_put_pc,
+						 queue_put_error, queue);
+		else
+			walked = u->tcb_walk(tcp, queue_put_call,
+					     queue_put_error, queue);
+		if (walked) {
+			if (u == unwinder)
+				++walks;
+			else
+				++fallback_walks;
+			break;
+		}
 	}
 }
 
+void
+unwind_print_stats(void)
+{
+	debug_msg("stack walks: %llu by %s unwinder, %llu by fallback",
+		  walks, unwinder->name, fallback_walks);
+	unwind_symbols_print_stats();
+}
+
 /*
  * printing stack
  */
@@ -270,12 +409,71 @@ unwind_tcb_print(struct tcb *tcp)
 		return;
 	}
 #endif
-	if (tcp->unwind_queue->head) {
-		debug_func_msg("head: tcp=%p, queue=%p",
-			       tcp, tcp->unwind_queue->head);
-		queue_print(tcp->unwind_queue);
-	} else
-		unwinder.tcb_walk(tcp, print_call_cb, print_error_cb, NULL);
+	struct unwind_queue_t *queue = tcp->unwind_queue;
+
+	/* The stack traces of syscalls are counted instead.  */
+	if (stack_profile_enabled)
+		return;
+
+	if (queue->nframes) {
+		debug_func_msg("captured: tcp=%p, queue=%p, frames=%zu",
+			       tcp, queue, queue->nframes);
+	} else {
+		queue_walk(tcp, queue, false);
+	}
+
+	queue->print_pending = true;
+	defer_tcp_output_flush(tcp);
+}
+
+bool
+unwind_tcb_print_pending(const struct tcb *tcp)
+{
+	return tcp->unwind_queue && tcp->unwind_queue->print_pending;
+}
+
+void
+unwind_tcb_print_deferred(struct tcb *tcp)
+{
+	if (unwind_tcb_print_pending(tcp))
+		queue_print(tcp, tcp->unwind_queue);
+}
+
+/* Drop the stack trace of a syscall whose output has been dropped.  */
+void
+unwind_tcb_discard(struct tcb *tcp)
+{
+	struct unwind_queue_t *queue = tcp->unwind_queue;
+
+	if (!queue)
+		return;
+
+	queue->nframes = 0;
+	queue->strings_len = 0;
+	queue->captured = false;
+}
+
+/*
+ * counting stack
+ */
+void
+unwind_tcb_profile(struct tcb *tcp, const struct timespec *ts)
+{
+#if SUPPORTED_PERSONALITIES > 1
+	if (tcp->currpers != DEFAULT_PERSONALITY) {
+		/* disable stack trace */
+		return;
+	}
+#endif
+	struct unwind_queue_t *queue = tcp->unwind_queue;
+	struct timespec dt;
+
+	if (!queue->nframes)
+		queue_walk(tcp, queue, true);
+
+	ts_sub(&dt, ts, &tcp->etime);
+	queue_profile(tcp, queue,
+		      dt.tv_sec < 0 ? 0 : dt.tv_sec * 1000000000ULL + dt.tv_nsec);
 }
 
 /*
@@ -290,12 +488,12 @@ unwind_tcb_capture(struct tcb *tcp)
 		return;
 	}
 #endif
-	if (tcp->unwind_queue->head)
+	if (tcp->unwind_queue->nframes)
 		error_msg_and_die("bug: unprinted entries in queue");
 	else {
 		debug_func_msg("walk: tcp=%p, queue=%p",
-			       tcp, tcp->unwind_queue->head);
-		unwinder.tcb_walk(tcp, queue_put_call, queue_put_error,
-				  tcp->unwind_queue);
+			       tcp, tcp->unwind_queue);
+		queue_walk(tcp, tcp->unwind_queue, true);
+		tcp->unwind_queue->captured = true;
 	}
 }
@@ -27,6 +27,8 @@ typedef void (*unwind_call_action_fn)(void *data,
 typedef void (*unwind_error_action_fn)(void *data,
 				       const char *error,
 				       unsigned long true_offset);
+typedef void (*unwind_pc_action_fn)(void *data,
+				    unsigned long pc);
 
 struct unwind_unwinder_t {
 	const char *name;
@@ -38,13 +40,83 @@ struct unwind_unwinder_t {
 	void * (*tcb_init)(struct tcb *);
 	void   (*tcb_fin)(struct tcb *);
 
-	/* Walk the stack. */
-	void   (*tcb_walk)(struct tcb *,
+	/*
+	 * Walk the stack.  Returns false if nothing has been reported
+	 * and the stack is to be walked by the fallback unwinder.
+	 */
+	bool   (*tcb_walk)(struct tcb *,
 			   unwind_call_action_fn,
 			   unwind_error_action_fn,
 			   void *);
+
+	/*
+	 * Walk the stack without resolving symbols, optional.
+	 * The program counters are resolved with tcb_symbolize,
+	 * before the stack of another tracee is walked.
+	 */
+	bool   (*tcb_walk_pcs)(struct tcb *,
+			       unwind_pc_action_fn,
+			       unwind_error_action_fn,
+			       void *);
+	void   (*tcb_symbolize)(struct tcb *,
+				unsigned long pc,
+				unwind_call_action_fn,
+				void *);
+
+	/* The unwinder to try when this one cannot walk the stack. */
+	const struct unwind_unwinder_t *fallback;
 };
 
-extern const struct unwind_unwinder_t unwinder;
+/* The DWARF unwinder, libdw or libunwind, whichever is built in. */
+extern const struct unwind_unwinder_t dwarf_unwinder;
+/* The frame pointer unwinder, see unwind-fp.c. */
+extern const struct unwind_unwinder_t fp_unwinder;
+
+/* The unwinder selected with --stack-unwinder. */
+extern const struct unwind_unwinder_t *unwinder;
+
+/*
+ * Symbol cache shared by all tracees, see unwind-symbols.c.
+ */
+
+struct unwind_object;
+
+struct unwind_symbol {
+	char *name;
+	unwind_function_offset_t function_offset;
+};
+
+/* Find or make the object file with the given build-id. */
+extern struct unwind_object *
+unwind_object_by_build_id(const void *build_id, size_t len);
+/*
+ * Find or make the object file of the given name.  If ino is not 0,
+ * the file must be on the device dev and have the inode ino.
+ * Returns NULL if the file cannot be used.
+ */
+extern struct unwind_object *
+unwind_object_by_file(const char *filename, dev_t dev, unsigned long ino);
+
+/* Return the symbol at the offset in the object file, if known. */
+extern const struct unwind_symbol *
+unwind_symbol_lookup(const struct unwind_object *, unsigned long offset);
+/* Remember the symbol at the offset in the object file. */
+extern const struct unwind_symbol *
+unwind_symbol_add(const struct unwind_object *, unsigned long offset,
+		  const char *name, unwind_function_offset_t);
+extern void unwind_symbols_print_stats(void);
+
+/*
+ * Stack profile, see unwind-profile.c.
+ */
+
+/* Return the number of the frame. */
+extern unsigned int
+unwind_profile_frame(const char *binary_filename, const char *symbol_name,
+		     unsigned long true_offset);
+/* Count a syscall with the stack trace of the given frames. */
+extern void
+unwind_profile_add(const char *syscall, const unsigned int *frames,
+		   unsigned int nframes, unsigned long long time_ns);
 
 #endif /* !STRACE_UNWIND_H */
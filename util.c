@@ -23,6 +23,7 @@
 #endif
 #include <sys/uio.h>
 
+#include "ilog2.h"
 #include "largefile_wrappers.h"
 #include "number_set.h"
 #include "print_utils.h"
@@ -326,7 +327,7 @@ printaddr64(const uint64_t addr)
 	if (!addr)
 		tprints("NULL");
 	else
-		tprintf("%#" PRIx64, addr);
+		tprint_xint64(addr);
 }
 
 #define DEF_PRINTNUM(name, type) \
@@ -606,13 +607,74 @@ printpidfd(struct tcb *tcp, int fd, const char *path)
 	return ret;
 }
 
+/*
+ * Return the thread group id of the process the given pid belongs to,
+ * or the pid itself if it cannot be obtained.
+ */
+int
+get_proc_tgid(const int pid)
+{
+	char status_path[sizeof("/proc/%u/status") + sizeof(int) * 3];
+	xsprintf(status_path, "/proc/%u/status", pid);
+
+	FILE *f = fopen_stream(status_path, "r");
+	if (!f)
+		return pid;
+
+	static const char tgid_pfx[] = "Tgid:\t";
+	char *line = NULL;
+	size_t sz = 0;
+	int tgid = pid;
+	while (getline(&line, &sz, f) > 0) {
+		const char *pos = STR_STRIP_PREFIX(line, tgid_pfx);
+		if (pos == line)
+			continue;
+
+		int val = string_to_uint_ex(pos, NULL, INT_MAX, "\n");
+		if (val > 0)
+			tgid = val;
+
+		break;
+	}
+
+	free(line);
+	fclose(f);
+
+	return tgid;
+}
+
+/*
+ * Store the command name of the given pid in comm,
+ * or an empty string if it cannot be obtained.
+ */
+void
+get_proc_comm(const int pid, char *comm, const size_t size)
+{
+	char comm_path[sizeof("/proc/%u/comm") + sizeof(int) * 3];
+	xsprintf(comm_path, "/proc/%u/comm", pid);
+
+	comm[0] = '\0';
+
+	FILE *f = fopen_stream(comm_path, "r");
+	if (!f)
+		return;
+
+	if (fgets(comm, size, f))
+		comm[strcspn(comm, "\n")] = '\0';
+	else
+		comm[0] = '\0';
+
+	fclose(f);
+}
+
 void
 printfd(struct tcb *tcp, int fd)
 {
 	char path[PATH_MAX + 1];
 	if (!number_set_array_is_empty(decode_fd_set, 0)
 	    && getfdpath(tcp, fd, path, sizeof(path)) >= 0) {
-		tprintf("%d<", (int) fd);
+		tprint_int64(fd);
+		tprints("<");
 		if (is_number_in_set(DECODE_FD_SOCKET, decode_fd_set) &&
 		    printsocket(tcp, fd, path))
 			goto printed;
@@ -628,7 +690,7 @@ printfd(struct tcb *tcp, int fd)
 printed:
 		tprints(">");
 	} else {
-		tprintf("%d", fd);
+		tprint_int64(fd);
 	}
 }
 
@@ -643,6 +705,52 @@ print_pid_fd(struct tcb *tcp, pid_t pid, int fd)
 	tprintf("%d", fd);
 }
 
+/*
+ * Return the length of the longest prefix of `ustr' of length `size'
+ * that consists of characters copied by string_quote as is, that is,
+ * printable ASCII characters other than the double quote and the backslash.
+ *
+ * The bulk of the string is checked a word at a time.  Prefixes shorter
+ * than a word are not worth it and are reported as empty, so that binary
+ * data, where such short runs are common, costs a single word check.
+ */
+static unsigned int
+plain_prefix_len(const unsigned char *ustr, const unsigned int size)
+{
+#define REP_BYTE(c_) (~0UL / 0xff * (c_))
+#define HAS_ZERO_BYTE(w_) (((w_) - REP_BYTE(0x01)) & ~(w_) & REP_BYTE(0x80))
+	unsigned int i = 0;
+
+	for (; i + sizeof(unsigned long) <= size; i += sizeof(unsigned long)) {
+		unsigned long w;
+
+		memcpy(&w, ustr + i, sizeof(w));
+
+		/*
+		 * Bail out on bytes with the high bit set,
+		 * bytes below ' ', the DEL character, '"', and '\\'.
+		 */
+		if ((w & REP_BYTE(0x80)) ||
+		    ((w - REP_BYTE(' ')) & REP_BYTE(0x80)) ||
+		    ((w + REP_BYTE(0x01)) & REP_BYTE(0x80)) ||
+		    HAS_ZERO_BYTE(w ^ REP_BYTE('\"')) ||
+		    HAS_ZERO_BYTE(w ^ REP_BYTE('\\')))
+			break;
+	}
+#undef HAS_ZERO_BYTE
+#undef REP_BYTE
+
+	if (!i)
+		return 0;
+
+	for (; i < size; ++i) {
+		if (!is_print(ustr[i]) || ustr[i] == '\"' || ustr[i] == '\\')
+			break;
+	}
+
+	return i;
+}
+
 /*
  * Quote string `instr' of length `size'
  * Write up to (3 + `size' * 4) bytes to `outstr' buffer.
@@ -763,6 +871,25 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 
 			if (printable) {
 				*s++ = c;
+
+				/*
+				 * Copy the run of characters that need
+				 * no escaping that follows in bulk.
+				 * None of them is NUL, so neither eol nor
+				 * the trailing 0 checks above could match
+				 * inside such a run.
+				 */
+				if (!escape_chars) {
+					const unsigned int len =
+						plain_prefix_len(ustr + i + 1,
+								 size - i - 1);
+
+					if (len) {
+						memcpy(s, ustr + i + 1, len);
+						s += len;
+						i += len;
+					}
+				}
 			} else {
 				/* Print \octal */
 				*s++ = '\\';
@@ -1056,194 +1183,58 @@ print_nonzero_bytes(struct tcb *const tcp, const char *prefix,
 	return ret;
 }
 
-void
-dumpiov_upto(struct tcb *const tcp, const int len, const kernel_ulong_t addr,
-	     kernel_ulong_t data_size)
-{
-#if ANY_WORDSIZE_LESS_THAN_KERNEL_LONG
-	union {
-		struct { uint32_t base; uint32_t len; } *iov32;
-		struct { uint64_t base; uint64_t len; } *iov64;
-	} iovu;
-# define iov iovu.iov64
-# define sizeof_iov \
-	(current_wordsize == 4 ? (unsigned int) sizeof(*iovu.iov32)	\
-			       : (unsigned int) sizeof(*iovu.iov64))
-# define iov_iov_base(i) \
-	(current_wordsize == 4 ? (uint64_t) iovu.iov32[i].base : iovu.iov64[i].base)
-# define iov_iov_len(i) \
-	(current_wordsize == 4 ? (uint64_t) iovu.iov32[i].len : iovu.iov64[i].len)
-#else
-	struct iovec *iov;
-# define sizeof_iov ((unsigned int) sizeof(*iov))
-# define iov_iov_base(i) ptr_to_kulong(iov[i].iov_base)
-# define iov_iov_len(i) iov[i].iov_len
-#endif
-	int i;
-	unsigned int size = sizeof_iov * len;
-	if (size / sizeof_iov != (unsigned int) len) {
-		error_func_msg("requested %u iovec elements exceeds"
-			       " %u iovec limit", len, -1U / sizeof_iov);
-		return;
-	}
-
-	iov = malloc(size);
-	if (!iov) {
-		error_func_msg("memory exhausted when tried to allocate"
-			       " %u bytes", size);
-		return;
-	}
-	if (umoven(tcp, addr, size, iov) >= 0) {
-		for (i = 0; i < len; i++) {
-			kernel_ulong_t iov_len = iov_iov_len(i);
-			if (iov_len > data_size)
-				iov_len = data_size;
-			if (!iov_len)
-				break;
-			data_size -= iov_len;
-			/* include the buffer number to make it easy to
-			 * match up the trace with the source */
-			tprintf(" * %" PRI_klu " bytes in buffer %d\n", iov_len, i);
-			dumpstr(tcp, iov_iov_base(i), iov_len);
-		}
-	}
-	free(iov);
-#undef sizeof_iov
-#undef iov_iov_base
-#undef iov_iov_len
-#undef iov
-}
+/* xx xx xx xx xx xx xx xx  xx xx xx xx xx xx xx xx  1234567890123456 */
+enum {
+	HEX_BIT = 4,
 
-#define ILOG2_ITER_(val_, ret_, bit_)					\
-	do {								\
-		typeof(ret_) shift_ =					\
-			((val_) > ((((typeof(val_)) 1)			\
-				   << (1 << (bit_))) - 1)) << (bit_);	\
-		(val_) >>= shift_;					\
-		(ret_) |= shift_;					\
-	} while (0)
+	DUMPSTR_GROUP_BYTES = 8,
+	DUMPSTR_GROUPS = 2,
+	DUMPSTR_WIDTH_BYTES = DUMPSTR_GROUP_BYTES * DUMPSTR_GROUPS,
 
-#if SIZEOF_KERNEL_LONG_T > 4
+	/** Width of formatted dump in characters.  */
+	DUMPSTR_WIDTH_CHARS = DUMPSTR_WIDTH_BYTES +
+		sizeof("xx") * DUMPSTR_WIDTH_BYTES + DUMPSTR_GROUPS,
 
-# define ilog2_klong ilog2_64
-/**
- * Calculate floor(log2(val)), with the exception of val == 0, for which 0
- * is returned as well.
- *
- * @param val 64-bit value to calculate integer base-2 logarithm for.
- * @return    (unsigned int) floor(log2(val)) if val > 0, 0 if val == 0.
- */
-static inline unsigned int
-ilog2_64(uint64_t val)
-{
-	unsigned int ret = 0;
+	DUMPSTR_GROUP_MASK = DUMPSTR_GROUP_BYTES - 1,
+	DUMPSTR_BYTES_MASK = DUMPSTR_WIDTH_BYTES - 1,
 
-	ILOG2_ITER_(val, ret, 5);
-	ILOG2_ITER_(val, ret, 4);
-	ILOG2_ITER_(val, ret, 3);
-	ILOG2_ITER_(val, ret, 2);
-	ILOG2_ITER_(val, ret, 1);
-	ILOG2_ITER_(val, ret, 0);
+	/** Minimal width of the offset field in the output.  */
+	DUMPSTR_OFFS_MIN_CHARS = 5,
 
-	return ret;
-}
+	/** Arbitrarily chosen internal dumpstr buffer limit.  */
+	DUMPSTR_BUF_MAXSZ = 1 << 16,
+};
 
-#else /* SIZEOF_KERNEL_LONG_T == 4 */
+static_assert(!(DUMPSTR_BUF_MAXSZ % DUMPSTR_WIDTH_BYTES),
+	      "Maximum internal buffer size should be divisible "
+	      "by amount of bytes dumped per line");
+static_assert(!(DUMPSTR_GROUP_BYTES & DUMPSTR_GROUP_MASK),
+	      "DUMPSTR_GROUP_BYTES is not power of 2");
+static_assert(!(DUMPSTR_WIDTH_BYTES & DUMPSTR_BYTES_MASK),
+	      "DUMPSTR_WIDTH_BYTES is not power of 2");
 
-# define ilog2_klong ilog2_32
 /**
- * Calculate floor(log2(val)), with the exception of val == 0, for which 0
- * is returned as well.
- *
- * @param val 32-bit value to calculate integer base-2 logarithm for.
- * @return    (unsigned int) floor(log2(val)) if val > 0, 0 if val == 0.
+ * Characters needed in order to print the offset field. We calculate
+ * it this way in order to avoid ilog2_64 call most of the time.
  */
-static inline unsigned int
-ilog2_32(uint32_t val)
+static int
+dumpstr_offs_chars(const kernel_ulong_t len)
 {
-	unsigned int ret = 0;
-
-	ILOG2_ITER_(val, ret, 4);
-	ILOG2_ITER_(val, ret, 3);
-	ILOG2_ITER_(val, ret, 2);
-	ILOG2_ITER_(val, ret, 1);
-	ILOG2_ITER_(val, ret, 0);
-
-	return ret;
+	return len > (1 << (DUMPSTR_OFFS_MIN_CHARS * HEX_BIT))
+		? 1 + ilog2_klong(len - 1) / HEX_BIT : DUMPSTR_OFFS_MIN_CHARS;
 }
 
-#endif /* SIZEOF_KERNEL_LONG_T */
-
-#undef ILOG2_ITER_
-
-void
-dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
-	const kernel_ulong_t len)
+/**
+ * Prints the dump lines of the data at src that starts at offset i
+ * and ends at offset end of the len bytes long buffer being dumped.
+ * i must be a multiple of DUMPSTR_WIDTH_BYTES.
+ */
+static void
+dumpstr_lines(const unsigned char *src, kernel_ulong_t i,
+	      const kernel_ulong_t end, const kernel_ulong_t len,
+	      const int offs_chars)
 {
-	/* xx xx xx xx xx xx xx xx  xx xx xx xx xx xx xx xx  1234567890123456 */
-	enum {
-		HEX_BIT = 4,
-
-		DUMPSTR_GROUP_BYTES = 8,
-		DUMPSTR_GROUPS = 2,
-		DUMPSTR_WIDTH_BYTES = DUMPSTR_GROUP_BYTES * DUMPSTR_GROUPS,
-
-		/** Width of formatted dump in characters.  */
-		DUMPSTR_WIDTH_CHARS = DUMPSTR_WIDTH_BYTES +
-			sizeof("xx") * DUMPSTR_WIDTH_BYTES + DUMPSTR_GROUPS,
-
-		DUMPSTR_GROUP_MASK = DUMPSTR_GROUP_BYTES - 1,
-		DUMPSTR_BYTES_MASK = DUMPSTR_WIDTH_BYTES - 1,
-
-		/** Minimal width of the offset field in the output.  */
-		DUMPSTR_OFFS_MIN_CHARS = 5,
-
-		/** Arbitrarily chosen internal dumpstr buffer limit.  */
-		DUMPSTR_BUF_MAXSZ = 1 << 16,
-	};
-
-	static_assert(!(DUMPSTR_BUF_MAXSZ % DUMPSTR_WIDTH_BYTES),
-		      "Maximum internal buffer size should be divisible "
-		      "by amount of bytes dumped per line");
-	static_assert(!(DUMPSTR_GROUP_BYTES & DUMPSTR_GROUP_MASK),
-		      "DUMPSTR_GROUP_BYTES is not power of 2");
-	static_assert(!(DUMPSTR_WIDTH_BYTES & DUMPSTR_BYTES_MASK),
-		      "DUMPSTR_WIDTH_BYTES is not power of 2");
-
-	if (len > len + DUMPSTR_WIDTH_BYTES || addr + len < addr) {
-		debug_func_msg("len %" PRI_klu " at addr %#" PRI_klx
-			       " is too big, skipped", len, addr);
-		return;
-	}
-
-	static kernel_ulong_t strsize;
-	static unsigned char *str;
-
-	const kernel_ulong_t alloc_size =
-		MIN(ROUNDUP(len, DUMPSTR_WIDTH_BYTES), DUMPSTR_BUF_MAXSZ);
-
-	if (strsize < alloc_size) {
-		free(str);
-		str = malloc(alloc_size);
-		if (!str) {
-			strsize = 0;
-			error_func_msg("memory exhausted when tried to allocate"
-				       " %" PRI_klu " bytes", alloc_size);
-			return;
-		}
-		strsize = alloc_size;
-	}
-
-	/**
-	 * Characters needed in order to print the offset field. We calculate
-	 * it this way in order to avoid ilog2_64 call most of the time.
-	 */
-	const int offs_chars = len > (1 << (DUMPSTR_OFFS_MIN_CHARS * HEX_BIT))
-		? 1 + ilog2_klong(len - 1) / HEX_BIT : DUMPSTR_OFFS_MIN_CHARS;
-	kernel_ulong_t i = 0;
-	const unsigned char *src;
-
-	while (i < len) {
+	while (i < end) {
 		/*
 		 * It is important to overwrite all the byte values, as we
 		 * re-use the buffer in order to avoid its re-initialisation.
@@ -1254,27 +1245,6 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 		};
 		char *dst = outbuf;
 
-		/* Fetching data from tracee.  */
-		if (!i || (i % DUMPSTR_BUF_MAXSZ) == 0) {
-			kernel_ulong_t fetch_size = MIN(len - i, alloc_size);
-
-			if (umoven(tcp, addr + i, fetch_size, str) < 0) {
-				/*
-				 * Don't silently abort if we have printed
-				 * something already.
-				 */
-				if (i)
-					tprintf(" | <Cannot fetch %" PRI_klu
-						" byte%s from pid %d"
-						" @%#" PRI_klx ">\n",
-						fetch_size,
-						fetch_size == 1 ? "" : "s",
-						tcp->pid, addr + i);
-				return;
-			}
-			src = str;
-		}
-
 		/* hex dump */
 		do {
 			if (i < len) {
@@ -1310,6 +1280,159 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 	}
 }
 
+void
+dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
+	const kernel_ulong_t len)
+{
+	if (len > len + DUMPSTR_WIDTH_BYTES || addr + len < addr) {
+		debug_func_msg("len %" PRI_klu " at addr %#" PRI_klx
+			       " is too big, skipped", len, addr);
+		return;
+	}
+
+	static kernel_ulong_t strsize;
+	static unsigned char *str;
+
+	const kernel_ulong_t alloc_size =
+		MIN(ROUNDUP(len, DUMPSTR_WIDTH_BYTES), DUMPSTR_BUF_MAXSZ);
+
+	if (strsize < alloc_size) {
+		free(str);
+		str = malloc(alloc_size);
+		if (!str) {
+			strsize = 0;
+			error_func_msg("memory exhausted when tried to allocate"
+				       " %" PRI_klu " bytes", alloc_size);
+			return;
+		}
+		strsize = alloc_size;
+	}
+
+	const int offs_chars = dumpstr_offs_chars(len);
+	kernel_ulong_t i = 0;
+
+	while (i < len) {
+		/* Fetching data from tracee.  */
+		kernel_ulong_t fetch_size = MIN(len - i, alloc_size);
+
+		if (umoven(tcp, addr + i, fetch_size, str) < 0) {
+			/*
+			 * Don't silently abort if we have printed
+			 * something already.
+			 */
+			if (i)
+				tprintf(" | <Cannot fetch %" PRI_klu
+					" byte%s from pid %d"
+					" @%#" PRI_klx ">\n",
+					fetch_size,
+					fetch_size == 1 ? "" : "s",
+					tcp->pid, addr + i);
+			return;
+		}
+
+		dumpstr_lines(str, i, i + fetch_size, len, offs_chars);
+		i += fetch_size;
+	}
+}
+
+void
+dumpiov_upto(struct tcb *const tcp, const int len, const kernel_ulong_t addr,
+	     kernel_ulong_t data_size)
+{
+#if ANY_WORDSIZE_LESS_THAN_KERNEL_LONG
+	union {
+		struct { uint32_t base; uint32_t len; } *iov32;
+		struct { uint64_t base; uint64_t len; } *iov64;
+	} iovu;
+# define iov iovu.iov64
+# define sizeof_iov \
+	(current_wordsize == 4 ? (unsigned int) sizeof(*iovu.iov32)	\
+			       : (unsigned int) sizeof(*iovu.iov64))
+# define iov_iov_base(i) \
+	(current_wordsize == 4 ? (uint64_t) iovu.iov32[i].base : iovu.iov64[i].base)
+# define iov_iov_len(i) \
+	(current_wordsize == 4 ? (uint64_t) iovu.iov32[i].len : iovu.iov64[i].len)
+#else
+	struct iovec *iov;
+# define sizeof_iov ((unsigned int) sizeof(*iov))
+# define iov_iov_base(i) ptr_to_kulong(iov[i].iov_base)
+# define iov_iov_len(i) iov[i].iov_len
+#endif
+	int i;
+	unsigned int size = sizeof_iov * len;
+	if (size / sizeof_iov != (unsigned int) len) {
+		error_func_msg("requested %u iovec elements exceeds"
+			       " %u iovec limit", len, -1U / sizeof_iov);
+		return;
+	}
+
+	iov = malloc(size);
+	if (!iov) {
+		error_func_msg("memory exhausted when tried to allocate"
+			       " %u bytes", size);
+		return;
+	}
+	if (umoven(tcp, addr, size, iov) < 0) {
+		free(iov);
+		return;
+	}
+
+	/*
+	 * Unless the buffers are too big, fetch all of them at once
+	 * and dump them from our memory.
+	 */
+	struct umove_iov *riov = malloc(sizeof(*riov) * len);
+	unsigned int cnt = 0;
+	kernel_ulong_t total = 0;
+	kernel_ulong_t left = data_size;
+
+	for (i = 0; riov && i < len; i++) {
+		kernel_ulong_t iov_len = iov_iov_len(i);
+		if (iov_len > left)
+			iov_len = left;
+		if (!iov_len)
+			break;
+		if (iov_len > DUMPSTR_BUF_MAXSZ - total)
+			break;
+		left -= iov_len;
+		total += iov_len;
+		riov[cnt].addr = iov_iov_base(i);
+		riov[cnt].len = iov_len;
+		cnt++;
+	}
+
+	unsigned char *buf = cnt > 1 ? malloc(total) : NULL;
+	unsigned int fetched = buf ? umoven_iov(tcp, riov, cnt, buf) : 0;
+	const unsigned char *src = buf;
+
+	for (i = 0; i < len; i++) {
+		kernel_ulong_t iov_len = iov_iov_len(i);
+		if (iov_len > data_size)
+			iov_len = data_size;
+		if (!iov_len)
+			break;
+		data_size -= iov_len;
+		/* include the buffer number to make it easy to
+		 * match up the trace with the source */
+		tprintf(" * %" PRI_klu " bytes in buffer %d\n", iov_len, i);
+		if ((unsigned int) i < fetched) {
+			dumpstr_lines(src, 0, iov_len, iov_len,
+				      dumpstr_offs_chars(iov_len));
+			src += iov_len;
+		} else {
+			dumpstr(tcp, iov_iov_base(i), iov_len);
+		}
+	}
+
+	free(buf);
+	free(riov);
+	free(iov);
+#undef sizeof_iov
+#undef iov_iov_base
+#undef iov_iov_len
+#undef iov
+}
+
 bool
 tfetch_mem64(struct tcb *const tcp, const uint64_t addr,
 	     const unsigned int len, void *const our_addr)